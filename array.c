@@ -1,438 +1,4763 @@
+// For mremap
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "array.h"
 
-struct Array {
-	size_t size;
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ARRAY_MMAP
+#endif
+
+#ifndef ARRAY_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef ARRAY_STATS
+#include <time.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ARRAY_SIMD_X86
+#endif
+
+#define ARRAY_ALIGNMENT _Alignof(max_align_t)
+#define ARRAY_ARENA_BLOCK_SIZE 65536
+// Block pool size classes go 16, 32, ... 64 KiB, bigger ones use malloc
+#define ARRAY_POOL_CLASSES 13
+// Iterator map results live here unless a pipeline needs more
+#define ARRAY_ITER_SCRATCH 256
+
+static size_t array_align(size_t size) {
+	return (size + ARRAY_ALIGNMENT - 1) & ~(ARRAY_ALIGNMENT - 1);
+}
+
+static void *array_allocate(const ArrayAllocator *allocator, size_t size) {
+	if (!allocator->alloc) {
+		return malloc(size);
+	}
+	return allocator->alloc(allocator->context, size);
+}
+
+static void *array_reallocate(const ArrayAllocator *allocator, void *pointer,
+		size_t old_size, size_t new_size) {
+	if (!allocator->realloc) {
+		return realloc(pointer, new_size);
+	}
+	return allocator->realloc(allocator->context, pointer, old_size, new_size);
+}
+
+static void array_deallocate(const ArrayAllocator *allocator, void *pointer,
+		size_t size) {
+	if (!allocator->free) {
+		free(pointer);
+		return;
+	}
+	allocator->free(allocator->context, pointer, size);
+}
+
+typedef struct ArrayArenaBlock {
+	struct ArrayArenaBlock *next;
 	size_t capacity;
-	size_t element_size;
-	void (*element_free)(void *);
-	void *data;
+	size_t used;
+	_Alignas(max_align_t) char data[];
+} ArrayArenaBlock;
+
+// Blocks are a stack, allocations bump the top one
+struct ArrayArena {
+	ArrayArenaBlock *blocks;
+	size_t block_size;
+	// Latest allocation, the only one free and realloc can do anything with
+	void *last;
 };
 
-Array *_array_new(size_t type_size) {
-	Array *array = malloc(sizeof(Array));
-	if (!array) {
+ArrayArena *array_arena_new(size_t block_size) {
+	ArrayArena *arena = malloc(sizeof(ArrayArena));
+	if (!arena) {
+		printf("malloc failed\n");
 		return NULL;
 	}
+	arena->blocks = NULL;
+	arena->block_size = block_size ? block_size : ARRAY_ARENA_BLOCK_SIZE;
+	arena->last = NULL;
+	return arena;
+}
 
-	array->size = 0;
-	array->capacity = MIN_CAPACITY;
-	array->element_size = type_size;
-	array->element_free = NULL;
-	// Fine for most platforms, not guaranteed to be 0.0 or NULL ptr technically
-	array->data = calloc(MIN_CAPACITY, type_size);
-	if (!array->data) {
-		free(array);
-		return NULL;
+static void *array_arena_alloc(void *context, size_t size) {
+	ArrayArena *arena = context;
+	size = array_align(size);
+
+	ArrayArenaBlock *block = arena->blocks;
+	if (!block || block->capacity - block->used < size) {
+		size_t capacity = size > arena->block_size ? size : arena->block_size;
+		block = malloc(sizeof(ArrayArenaBlock) + capacity);
+		if (!block) {
+			printf("malloc failed\n");
+			return NULL;
+		}
+		block->next = arena->blocks;
+		block->capacity = capacity;
+		block->used = 0;
+		arena->blocks = block;
 	}
 
-	return array;
+	arena->last = block->data + block->used;
+	block->used += size;
+	return arena->last;
 }
 
-Array *_array_new_with_size(size_t type_size, size_t size) {
-	Array *array = _array_new(type_size);
-	array_resize(array, size);
-	return array;
+static void *array_arena_realloc(void *context, void *pointer, size_t old_size,
+		size_t new_size) {
+	ArrayArena *arena = context;
+	if (!pointer) {
+		return array_arena_alloc(arena, new_size);
+	}
+
+	// The latest allocation can grow or shrink in place
+	ArrayArenaBlock *block = arena->blocks;
+	if (pointer == arena->last) {
+		size_t start = block->used - array_align(old_size);
+		if (block->capacity - start >= array_align(new_size)) {
+			block->used = start + array_align(new_size);
+			return pointer;
+		}
+	} else if (new_size <= old_size) {
+		return pointer;
+	}
+
+	void *moved = array_arena_alloc(arena, new_size);
+	if (moved) {
+		memcpy(moved, pointer, old_size < new_size ? old_size : new_size);
+	}
+	return moved;
 }
 
-void array_free(Array *array) {
-	if (!array) {
+static void array_arena_dealloc(void *context, void *pointer, size_t size) {
+	ArrayArena *arena = context;
+	if (pointer && pointer == arena->last) {
+		arena->blocks->used -= array_align(size);
+		arena->last = NULL;
+	}
+}
+
+ArrayAllocator array_arena_allocator(ArrayArena *arena) {
+	return (ArrayAllocator){ array_arena_alloc, array_arena_realloc,
+		array_arena_dealloc, arena };
+}
+
+void array_arena_reset(ArrayArena *arena) {
+	if (!arena->blocks) {
 		return;
 	}
 
-	// Optionally free elements that are heap allocated
-	if (array->element_free) {
-		for (size_t i = 0; i < array->size; i++) {
-			if (!_array_at(array, i)) {
-				continue;
-			}
-			array->element_free(_array_at(array, i));
-		}
+	// Keep the newest block around for the next round
+	ArrayArenaBlock *block = arena->blocks->next;
+	while (block) {
+		ArrayArenaBlock *next = block->next;
+		free(block);
+		block = next;
 	}
+	arena->blocks->next = NULL;
+	arena->blocks->used = 0;
+	arena->last = NULL;
+}
 
-	free(array->data);
-	free(array);
+void array_arena_free(ArrayArena *arena) {
+	if (!arena) {
+		return;
+	}
+	array_arena_reset(arena);
+	free(arena->blocks);
+	free(arena);
 }
 
-void array_set_element_free(Array *array, void (*p_element_free)(void *)) {
-	array->element_free = p_element_free;
+typedef struct ArrayPoolLarge {
+	struct ArrayPoolLarge *previous;
+	struct ArrayPoolLarge *next;
+	_Alignas(max_align_t) char data[];
+} ArrayPoolLarge;
+
+// Small blocks are carved out of an arena and go back on a free list for
+// their size class, large ones are kept in a list so reset can free them
+struct ArrayBlockPool {
+	ArrayArena *arena;
+	void *free_lists[ARRAY_POOL_CLASSES];
+	ArrayPoolLarge *large;
+};
+
+static size_t array_pool_class(size_t size) {
+	size_t class = 0;
+	while (class < ARRAY_POOL_CLASSES && ((size_t)16 << class) < size) {
+		class++;
+	}
+	return class;
 }
 
-Array *array_duplicate(Array *array) {
-	return array_duplicate_custom(array, NULL);
+ArrayBlockPool *array_block_pool_new(void) {
+	ArrayBlockPool *pool = malloc(sizeof(ArrayBlockPool));
+	if (!pool) {
+		printf("malloc failed\n");
+		return NULL;
+	}
+	pool->arena = array_arena_new(0);
+	if (!pool->arena) {
+		free(pool);
+		return NULL;
+	}
+	memset(pool->free_lists, 0, sizeof(pool->free_lists));
+	pool->large = NULL;
+	return pool;
 }
 
-Array *array_duplicate_custom(Array *array,
-		void (*element_duplicate)(void *, void *)) {
-	Array *duplicate = _array_new_with_size(array->element_size, array->size);
-	duplicate->element_free = array->element_free;
+static void *array_block_pool_alloc(void *context, size_t size) {
+	ArrayBlockPool *pool = context;
+	size_t class = array_pool_class(size);
 
-	for (size_t i = 0; i < array->size; i++) {
-		if (!element_duplicate) {
-			memcpy(_array_at(duplicate, i), _array_at(array, i), array->element_size);
-		} else {
-			element_duplicate(_array_at(duplicate, i), _array_at(array, i));
+	if (class < ARRAY_POOL_CLASSES) {
+		void *block = pool->free_lists[class];
+		if (block) {
+			memcpy(&pool->free_lists[class], block, sizeof(void *));
+			return block;
 		}
+		return array_arena_alloc(pool->arena, (size_t)16 << class);
 	}
-	return duplicate;
+
+	ArrayPoolLarge *large = malloc(sizeof(ArrayPoolLarge) + size);
+	if (!large) {
+		printf("malloc failed\n");
+		return NULL;
+	}
+	large->previous = NULL;
+	large->next = pool->large;
+	if (pool->large) {
+		pool->large->previous = large;
+	}
+	pool->large = large;
+	return large->data;
 }
 
-size_t array_size(Array *array) {
-	return array->size;
+static void array_block_pool_dealloc(void *context, void *pointer, size_t size) {
+	ArrayBlockPool *pool = context;
+	if (!pointer) {
+		return;
+	}
+
+	size_t class = array_pool_class(size);
+	if (class < ARRAY_POOL_CLASSES) {
+		memcpy(pointer, &pool->free_lists[class], sizeof(void *));
+		pool->free_lists[class] = pointer;
+		return;
+	}
+
+	ArrayPoolLarge *large = (ArrayPoolLarge *)((char *)pointer -
+			offsetof(ArrayPoolLarge, data));
+	if (large->previous) {
+		large->previous->next = large->next;
+	} else {
+		pool->large = large->next;
+	}
+	if (large->next) {
+		large->next->previous = large->previous;
+	}
+	free(large);
 }
 
-size_t array_capacity(Array *array) {
-	return array->capacity;
+static void *array_block_pool_realloc(void *context, void *pointer,
+		size_t old_size, size_t new_size) {
+	if (!pointer) {
+		return array_block_pool_alloc(context, new_size);
+	}
+
+	// Still the same size class, the block already fits
+	size_t class = array_pool_class(old_size);
+	if (class < ARRAY_POOL_CLASSES && class == array_pool_class(new_size)) {
+		return pointer;
+	}
+
+	void *moved = array_block_pool_alloc(context, new_size);
+	if (!moved) {
+		return NULL;
+	}
+	memcpy(moved, pointer, old_size < new_size ? old_size : new_size);
+	array_block_pool_dealloc(context, pointer, old_size);
+	return moved;
 }
 
-size_t array_element_size(Array *array) {
-	return array->element_size;
+ArrayAllocator array_block_pool_allocator(ArrayBlockPool *pool) {
+	return (ArrayAllocator){ array_block_pool_alloc, array_block_pool_realloc,
+		array_block_pool_dealloc, pool };
 }
 
-void *array_element_free(Array *array) {
-	return array->element_free;
+void array_block_pool_reset(ArrayBlockPool *pool) {
+	array_arena_reset(pool->arena);
+	memset(pool->free_lists, 0, sizeof(pool->free_lists));
+	while (pool->large) {
+		ArrayPoolLarge *next = pool->large->next;
+		free(pool->large);
+		pool->large = next;
+	}
 }
 
-void *array_data(Array *array) {
-	return array->data;
+void array_block_pool_free(ArrayBlockPool *pool) {
+	if (!pool) {
+		return;
+	}
+	array_block_pool_reset(pool);
+	array_arena_free(pool->arena);
+	free(pool);
 }
 
-bool array_empty(Array *array) {
-	return array->size == 0;
+#ifdef ARRAY_STATS
+// Stats live outside the array's allocation, so dumping never reads an
+// array an arena reset has freed
+typedef struct ArrayStatsNode {
+	ArrayStats stats;
+	struct ArrayStatsNode *prev;
+	struct ArrayStatsNode *next;
+} ArrayStatsNode;
+
+static ArrayStatsNode *array_stats_live = NULL;
+
+#ifndef ARRAY_NO_THREADS
+static pthread_mutex_t array_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#define array_stats_lock() pthread_mutex_lock(&array_stats_lock)
+#define array_stats_unlock() pthread_mutex_unlock(&array_stats_lock)
+#else
+#define array_stats_lock() ((void)0)
+#define array_stats_unlock() ((void)0)
+#endif
+
+static void array_stats_resized(Array *array);
+
+static void array_stats_register(Array *array) {
+	ArrayStatsNode *node = calloc(1, sizeof(ArrayStatsNode));
+	array->stats = (ArrayStats *)node;
+	if (!node) {
+		return;
+	}
+	node->stats.element_size = array->element_size;
+	array_stats_resized(array);
+
+	array_stats_lock();
+	node->next = array_stats_live;
+	if (node->next) {
+		node->next->prev = node;
+	}
+	array_stats_live = node;
+	array_stats_unlock();
 }
 
-ptrdiff_t array_find(Array *array, void *element) {
-	return array_find_custom(array, NULL, element);
+static void array_stats_unregister(Array *array) {
+	ArrayStatsNode *node = (ArrayStatsNode *)array->stats;
+	if (!node) {
+		return;
+	}
+
+	array_stats_lock();
+	if (node->prev) {
+		node->prev->next = node->next;
+	} else {
+		array_stats_live = node->next;
+	}
+	if (node->next) {
+		node->next->prev = node->prev;
+	}
+	array_stats_unlock();
+	free(node);
+	array->stats = NULL;
 }
 
-ptrdiff_t array_find_custom(Array *array, int (*compare)(void *, void *),
-		void *element) {
-	for (size_t i = 0; i < array->size; i++) {
-		int diff = compare
-				? compare(_array_at(array, i), element)
-				: memcmp(_array_at(array, i), element, array->element_size);
-		if (diff == 0) {
-			return i;
-		}
+static inline void array_stats_call(Array *array, ArrayOp op) {
+	if (array->stats) {
+		array->stats->calls[op]++;
 	}
-	return -1;
 }
 
-bool array_contains(Array *array, void *element) {
-	return array_find(array, element) != -1;
+static inline void array_stats_moved(Array *array, size_t bytes) {
+	if (array->stats) {
+		array->stats->bytes_moved += bytes;
+	}
 }
 
-bool array_contains_custom(Array *array, int (*compare)(void *, void *),
-		void *element) {
-	return array_find_custom(array, compare, element) != -1;
+static inline void array_stats_realloc(Array *array, size_t bytes) {
+	if (array->stats) {
+		array->stats->reallocs++;
+		array->stats->bytes_moved += bytes;
+	}
 }
 
-size_t array_count(Array *array, void *element) {
-	return array_count_custom(array, NULL, element);
+static void array_stats_resized(Array *array) {
+	ArrayStats *stats = array->stats;
+	if (!stats) {
+		return;
+	}
+	stats->size = array->size;
+	stats->capacity = array->capacity;
+	stats->peak_size = stats->size > stats->peak_size ? stats->size : stats->peak_size;
+	stats->peak_capacity = stats->capacity > stats->peak_capacity
+			? stats->capacity
+			: stats->peak_capacity;
 }
 
-size_t array_count_custom(Array *array, int (*compare)(void *, void *),
-		void *element) {
-	size_t count = 0;
-	for (size_t i = 0; i < array->size; i++) {
-		int diff = compare
-				? compare(_array_at(array, i), element)
-				: memcmp(_array_at(array, i), element, array->element_size);
-		if (diff == 0) {
-			count++;
+static inline size_t array_stats_now(void) {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (size_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static inline void array_stats_scaled(Array *array, size_t started) {
+	array_stats_resized(array);
+	if (array->stats) {
+		array->stats->scale_ns += array_stats_now() - started;
+	}
+}
+#else
+// Arguments aren't evaluated, so none of this costs anything
+#define array_stats_register(array) ((void)0)
+#define array_stats_unregister(array) ((void)0)
+#define array_stats_call(array, op) ((void)0)
+#define array_stats_moved(array, bytes) ((void)0)
+#define array_stats_realloc(array, bytes) ((void)0)
+#define array_stats_resized(array) ((void)0)
+#define array_stats_now() 0
+#define array_stats_scaled(array, started) ((void)(started))
+#endif
+
+// Open addressing hash table of element positions in data, so it never holds
+// copies of elements. Positions (not indices) don't change when a deque
+// pushes or pops at its front.
+struct ArrayIndex {
+	size_t (*hash)(void *);
+	int (*compare)(void *, void *);
+	size_t *slots;
+	size_t mask;
+	size_t count;
+	// Lost track of an element, rebuilt before the next lookup
+	bool stale;
+};
+
+#define ARRAY_INDEX_EMPTY SIZE_MAX
+
+static size_t array_hash_bytes(const void *element, size_t size) {
+	const unsigned char *bytes = element;
+	uint64_t hash = 0x9E3779B97F4A7C15u ^ size;
+	for (; size >= 8; size -= 8, bytes += 8) {
+		uint64_t chunk;
+		memcpy(&chunk, bytes, 8);
+		hash = (hash ^ chunk) * 0xBF58476D1CE4E5B9u;
+		hash ^= hash >> 31;
+	}
+	for (; size > 0; size--, bytes++) {
+		hash = (hash ^ *bytes) * 0x94D049BB133111EBu;
+	}
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9u;
+	hash ^= hash >> 32;
+	return (size_t)hash;
+}
+
+static inline size_t array_index_hash(Array *array, void *element) {
+	ArrayIndex *index = array->index;
+	return index->hash ? index->hash(element)
+					   : array_hash_bytes(element, array->element_size);
+}
+
+static inline bool array_index_equal(Array *array, void *a, void *b) {
+	ArrayIndex *index = array->index;
+	return index->compare ? index->compare(a, b) == 0
+						  : memcmp(a, b, array->element_size) == 0;
+}
+
+static inline void *array_position(Array *array, size_t position) {
+	return (char *)array->data + position * array->element_size;
+}
+
+static inline size_t array_index_position(Array *array, size_t i) {
+	size_t position = array->head + i;
+	return position >= array->capacity ? position - array->capacity : position;
+}
+
+static void array_index_place(Array *array, size_t position) {
+	ArrayIndex *index = array->index;
+	size_t slot = array_index_hash(array, array_position(array, position)) &
+			index->mask;
+	while (index->slots[slot] != ARRAY_INDEX_EMPTY) {
+		slot = (slot + 1) & index->mask;
+	}
+	index->slots[slot] = position;
+	index->count++;
+}
+
+// Sizes the table for the current size and fills it again
+static bool array_index_rebuild(Array *array) {
+	ArrayIndex *index = array->index;
+
+	// Keep the load factor under a half so probe runs stay short
+	size_t slot_count = 16;
+	while (slot_count < 2 * (array->size + 1)) {
+		slot_count *= 2;
+	}
+
+	if (slot_count != index->mask + 1) {
+		size_t *slots = malloc(slot_count * sizeof(size_t));
+		if (!slots) {
+			printf("malloc failed\n");
+			return false;
 		}
+		free(index->slots);
+		index->slots = slots;
+		index->mask = slot_count - 1;
 	}
-	return count;
+
+	memset(index->slots, 0xFF, slot_count * sizeof(size_t));
+	index->count = 0;
+	index->stale = false;
+	for (size_t i = 0; i < array->size; i++) {
+		array_index_place(array, array_index_position(array, i));
+	}
+	return true;
 }
 
-void array_clear(Array *array) {
-	if (array->element_free) {
-		for (size_t i = 0; i < array->size; i++) {
-			array->element_free(_array_at(array, i));
+// Adds elements [start, end), which have to be in place already
+static void array_index_add(Array *array, size_t start, size_t end) {
+	ArrayIndex *index = array->index;
+	if (!index) {
+		return;
+	}
+	if (2 * (index->count + end - start) > index->mask + 1) {
+		array_index_rebuild(array);
+		return;
+	}
+	for (size_t i = start; i < end; i++) {
+		array_index_place(array, array_index_position(array, i));
+	}
+}
+
+// Drops elements [start, end) while they, and everything else, are still
+// where the table thinks they are
+static void array_index_drop(Array *array, size_t start, size_t end) {
+	ArrayIndex *index = array->index;
+	if (!index) {
+		return;
+	}
+
+	for (size_t i = start; i < end; i++) {
+		size_t position = array_index_position(array, i);
+		size_t slot = array_index_hash(array, array_position(array, position)) &
+				index->mask;
+		while (index->slots[slot] != position &&
+				index->slots[slot] != ARRAY_INDEX_EMPTY) {
+			slot = (slot + 1) & index->mask;
+		}
+		// Written behind the index's back, so not under its hash. The rest
+		// of the table can't be trusted either, start over at the next find.
+		if (index->slots[slot] != position) {
+			index->stale = true;
+			return;
+		}
+
+		// Backward shift deletion, pull later entries of the run into the
+		// hole unless that would put them before their home slot
+		size_t hole = slot;
+		for (size_t next = (hole + 1) & index->mask;
+				index->slots[next] != ARRAY_INDEX_EMPTY;
+				next = (next + 1) & index->mask) {
+			size_t home = array_index_hash(array, array_position(array, index->slots[next])) &
+					index->mask;
+			if (((next - home) & index->mask) >= ((next - hole) & index->mask)) {
+				index->slots[hole] = index->slots[next];
+				hole = next;
+			}
 		}
+		index->slots[hole] = ARRAY_INDEX_EMPTY;
+		index->count--;
 	}
+}
 
-	void *temp = calloc(MIN_CAPACITY, array->element_size);
-	if (!temp) {
-		printf("calloc failed\n");
+// Elements at positions [start, end) were moved by delta
+static void array_index_shift(Array *array, size_t start, size_t end,
+		ptrdiff_t delta) {
+	ArrayIndex *index = array->index;
+	if (!index || start >= end) {
 		return;
 	}
+	for (size_t slot = 0; slot <= index->mask; slot++) {
+		size_t position = index->slots[slot];
+		if (position != ARRAY_INDEX_EMPTY && position >= start && position < end) {
+			index->slots[slot] = position + delta;
+		}
+	}
+}
+
+// Whether lookups with compare can go through the index
+static bool array_index_usable(Array *array, int (*compare)(void *, void *)) {
+	if (!array->index || compare != array->index->compare) {
+		return false;
+	}
+	return !array->index->stale || array_index_rebuild(array);
+}
 
-	free(array->data);
+// First index of a match, or adds every match up into count
+static ptrdiff_t array_index_find(Array *array, void *element, size_t *count) {
+	ArrayIndex *index = array->index;
+	size_t found = SIZE_MAX;
 
-	array->size = 0;
-	array->capacity = MIN_CAPACITY;
-	array->data = temp;
+	// Equal elements all sit in the run starting at their home slot
+	size_t slot = array_index_hash(array, element) & index->mask;
+	for (; index->slots[slot] != ARRAY_INDEX_EMPTY; slot = (slot + 1) & index->mask) {
+		size_t position = index->slots[slot];
+		if (!array_index_equal(array, array_position(array, position), element)) {
+			continue;
+		}
+		if (count) {
+			(*count)++;
+			continue;
+		}
+		size_t i = (position + array->capacity - array->head) % array->capacity;
+		found = i < found ? i : found;
+	}
+	return found == SIZE_MAX ? -1 : (ptrdiff_t)found;
 }
-//
-void array_reverse(Array *array) {
-	for (size_t i = 0; i < array->size / 2; i++) {
-		memcpy(_array_unsafe_at(array, array->size), _array_at(array, i),
-				array->element_size);
-		memcpy(_array_at(array, i), _array_at(array, -1 - i), array->element_size);
-		memcpy(_array_at(array, -1 - i), _array_unsafe_at(array, array->size),
-				array->element_size);
+
+static bool array_own(Array *array);
+
+// Rotates a wrapped deque so element 0 is at the start of data again. The
+// slot past size comes along too, pops return a pointer to it.
+static bool array_linearize(Array *array) {
+	if (array->head == 0) {
+		return true;
+	}
+	if (!array_own(array)) {
+		return false;
+	}
+
+	size_t element_size = array->element_size;
+	size_t count = array->size + 1 < array->capacity ? array->size + 1
+													 : array->capacity;
+	size_t first = array->capacity - array->head;
+	char *data = array->data;
+	char *head = data + array->head * element_size;
+
+	// Wrapped, the smaller half goes aside while the other one moves. Get
+	// the buffer before touching anything so failing leaves the array as is.
+	size_t second = count > first ? count - first : 0;
+	size_t aside = first < second ? first : second;
+	char *temp = NULL;
+	if (second) {
+		temp = malloc(aside * element_size);
+		if (!temp) {
+			printf("malloc failed\n");
+			return false;
+		}
+	}
+
+	// Every position moves back by head, wrapping around
+	if (array->index) {
+		ArrayIndex *index = array->index;
+		for (size_t slot = 0; slot <= index->mask; slot++) {
+			size_t position = index->slots[slot];
+			if (position != ARRAY_INDEX_EMPTY) {
+				index->slots[slot] = (position + array->capacity - array->head) %
+						array->capacity;
+			}
+		}
+	}
+
+	array_stats_moved(array, count * element_size);
+	if (!second) {
+		memmove(data, head, count * element_size);
+		array->head = 0;
+		return true;
+	}
+	array_stats_moved(array, aside * element_size);
+
+	if (first <= second) {
+		memcpy(temp, head, first * element_size);
+		memmove(data + first * element_size, data, second * element_size);
+		memcpy(data, temp, first * element_size);
+	} else {
+		memcpy(temp, data, second * element_size);
+		memmove(data, head, first * element_size);
+		memcpy(data + first * element_size, temp, second * element_size);
+	}
+	free(temp);
+
+	array->head = 0;
+	return true;
+}
+
+// Copies n elements in at index, splitting the copy where a deque wraps
+static void array_copy_in(Array *array, size_t index, void *elements,
+		size_t n) {
+	size_t element_size = array->element_size;
+	size_t start = (array->head + index) % array->capacity;
+	size_t first = array->capacity - start < n ? array->capacity - start : n;
+
+	array_stats_moved(array, n * element_size);
+	memcpy((char *)array->data + start * element_size, elements,
+			first * element_size);
+	memcpy(array->data, (char *)elements + first * element_size,
+			(n - first) * element_size);
+}
+
+// The other way, n elements from index into a caller's buffer
+static void array_copy_out(Array *array, size_t index, void *elements,
+		size_t n) {
+	size_t element_size = array->element_size;
+	size_t start = (array->head + index) % array->capacity;
+	size_t first = array->capacity - start < n ? array->capacity - start : n;
+
+	array_stats_moved(array, n * element_size);
+	memcpy(elements, (char *)array->data + start * element_size,
+			first * element_size);
+	memcpy((char *)elements + first * element_size, array->data,
+			(n - first) * element_size);
+}
+
+// Mapped files start with a header page, elements follow it
+#define ARRAY_MAPPED_HEADER 64
+#define ARRAY_MAPPED_MAGIC "ARRAYMAP"
+
+typedef struct ArrayMappedHeader {
+	char magic[8];
+	uint64_t element_size;
+	uint64_t size;
+} ArrayMappedHeader;
+
+struct ArrayMapping {
+	int fd;
+	char *base;
+	size_t length;
+	bool read_only;
+};
+
+#ifdef ARRAY_MMAP
+// sysconf is a call, and the page size doesn't change while we run
+static size_t array_page_size(void) {
+	static atomic_size_t page_size;
+	size_t size = atomic_load_explicit(&page_size, memory_order_relaxed);
+	if (!size) {
+		long queried = sysconf(_SC_PAGESIZE);
+		size = queried > 0 ? (size_t)queried : 4096;
+		atomic_store_explicit(&page_size, size, memory_order_relaxed);
+	}
+	return size;
+}
+
+// Resizes the file and the mapping to hold at least capacity elements. New
+// pages read as zero, they aren't touched until used.
+static bool array_mapping_resize(Array *array, size_t capacity) {
+	ArrayMapping *mapping = array->mapping;
+	if (mapping->read_only) {
+		printf("array is mapped read only\n");
+		return false;
+	}
+
+	// The last page is mapped whole anyway, so fill it with capacity
+	size_t page_size = array_page_size();
+	size_t length = ARRAY_MAPPED_HEADER + capacity * array->element_size;
+	length = (length + page_size - 1) / page_size * page_size;
+	capacity = (length - ARRAY_MAPPED_HEADER) / array->element_size;
+	if (length > mapping->length && ftruncate(mapping->fd, length) != 0) {
+		printf("ftruncate failed\n");
+		return false;
+	}
+
+#ifdef __linux__
+	char *base = mremap(mapping->base, mapping->length, length, MREMAP_MAYMOVE);
+#else
+	munmap(mapping->base, mapping->length);
+	char *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			mapping->fd, 0);
+#endif
+	if (base == MAP_FAILED) {
+		printf("mremap failed\n");
+		return false;
+	}
+
+	if (length < mapping->length && ftruncate(mapping->fd, length) != 0) {
+		printf("ftruncate failed\n");
+	}
+	mapping->base = base;
+	mapping->length = length;
+	array->data = base + ARRAY_MAPPED_HEADER;
+	array->capacity = capacity;
+	return true;
+}
+#endif
+
+// Small arrays keep their data right after the header, in the same allocation
+static void *array_inline_data(Array *array) {
+	return (char *)array + array_align(sizeof(Array));
+}
+
+static bool array_is_inline(Array *array) {
+	return array->inline_capacity && array->data == array_inline_data(array);
+}
+
+// Data buffers honour the array's alignment when it's more than malloc's
+static void *array_data_allocate(Array *array, size_t size) {
+	size_t alignment = array->alignment;
+	if (alignment <= ARRAY_ALIGNMENT) {
+		return array_allocate(&array->allocator, size);
+	}
+	// aligned_alloc wants a multiple of the alignment
+	return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+static void *array_data_reallocate(Array *array, void *pointer,
+		size_t old_size, size_t new_size) {
+	if (array->alignment <= ARRAY_ALIGNMENT) {
+		return array_reallocate(&array->allocator, pointer, old_size, new_size);
+	}
+
+	// realloc doesn't keep alignment, move it by hand
+	void *data = array_data_allocate(array, new_size);
+	if (data) {
+		memcpy(data, pointer, old_size < new_size ? old_size : new_size);
+		free(pointer);
+	}
+	return data;
+}
+
+// Copy-on-write duplicates point at the same data and count references
+// here. Shared data always has head 0 and nobody writes to it.
+struct ArrayShared {
+	atomic_size_t references;
+};
+
+static bool array_shared_with_others(Array *array) {
+	return array->shared && atomic_load(&array->shared->references) > 1;
+}
+
+// Lets go of the shared data, true if other arrays still use it so the
+// caller mustn't free it
+static bool array_release(Array *array) {
+	ArrayShared *shared = array->shared;
+	if (!shared) {
+		return false;
+	}
+	array->shared = NULL;
+	if (atomic_fetch_sub(&shared->references, 1) == 1) {
+		free(shared);
+		return false;
+	}
+	return true;
+}
+
+// Gives array a private copy of its data before anything writes to it
+static bool array_unshare(Array *array) {
+	if (!array_shared_with_others(array)) {
+		array_release(array);
+		return true;
+	}
+
+	size_t bytes = array->capacity * array->element_size;
+	size_t used = array->size * array->element_size;
+	char *data = array_data_allocate(array, bytes);
+	if (!data) {
+		printf("malloc failed\n");
+		return false;
+	}
+	array_stats_moved(array, used);
+	memcpy(data, array->data, used);
+	memset(data + used, 0, bytes - used);
+
+	// Everyone else may have let go while we copied
+	if (!array_release(array)) {
+		array_deallocate(&array->allocator, array->data, bytes);
+	}
+	array->data = data;
+	return true;
+}
+
+static bool array_own(Array *array) {
+	return !array->shared || array_unshare(array);
+}
+
+#ifdef ARRAY_MMAP
+// Transparent huge pages are 2 MiB on x86-64 and most arm64 kernels, and
+// only back ranges aligned to one
+#define ARRAY_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+// Whole huge pages, so none of it has to fall back to small ones
+static size_t array_huge_length(Array *array, size_t capacity) {
+	size_t bytes = capacity * array->element_size;
+	return (bytes + ARRAY_HUGE_PAGE_SIZE - 1) & ~(ARRAY_HUGE_PAGE_SIZE - 1);
+}
+
+static bool array_wants_huge(Array *array, size_t capacity) {
+	return array->huge_pages && array->alignment <= ARRAY_HUGE_PAGE_SIZE &&
+			capacity * array->element_size >= ARRAY_HUGE_THRESHOLD;
+}
+
+// Anonymous mapping that starts on a huge page boundary. mmap only
+// promises page alignment, so map a bit extra and trim both ends.
+static char *array_huge_map(size_t length) {
+	size_t page_size = array_page_size();
+	size_t extra = page_size < ARRAY_HUGE_PAGE_SIZE
+			? ARRAY_HUGE_PAGE_SIZE - page_size
+			: 0;
+	char *mapped = mmap(NULL, length + extra, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED) {
+		return MAP_FAILED;
+	}
+
+	size_t head = (ARRAY_HUGE_PAGE_SIZE -
+						  (uintptr_t)mapped % ARRAY_HUGE_PAGE_SIZE) %
+			ARRAY_HUGE_PAGE_SIZE;
+	if (head) {
+		munmap(mapped, head);
+	}
+	if (extra > head) {
+		munmap(mapped + head + length, extra - head);
+	}
+	return mapped + head;
+}
+
+// Moves data into, within or out of its own anonymous mapping. Mapped
+// pages read as zero, so growing doesn't touch them.
+static bool array_huge_resize(Array *array, size_t capacity) {
+	size_t element_size = array->element_size;
+	size_t kept = (capacity < array->capacity ? capacity : array->capacity) *
+			element_size;
+	size_t old_length = array_huge_length(array, array->capacity);
+	size_t length = array_huge_length(array, capacity);
+	char *data;
+
+	if (!array_wants_huge(array, capacity)) {
+		// Back to the heap, or the header
+		data = capacity <= array->inline_capacity
+				? array_inline_data(array)
+				: array_data_allocate(array, capacity * element_size);
+		if (!data) {
+			printf("malloc failed\n");
+			return false;
+		}
+		memcpy(data, array->data, kept);
+		memset(data + kept, 0, capacity * element_size - kept);
+		munmap(array->data, old_length);
+		array_stats_realloc(array, kept);
+		array->huge = false;
+	} else if (array->huge) {
+#ifdef __linux__
+		// In place keeps the alignment. Otherwise the pages move, without
+		// copying, onto a fresh aligned range.
+		data = mremap(array->data, old_length, length, 0);
+		if (data == MAP_FAILED) {
+			char *target = array_huge_map(length);
+			if (target != MAP_FAILED) {
+				data = mremap(array->data, old_length, length,
+						MREMAP_MAYMOVE | MREMAP_FIXED, target);
+				if (data == MAP_FAILED) {
+					munmap(target, length);
+				}
+			}
+		}
+#else
+		data = array_huge_map(length);
+		if (data != MAP_FAILED) {
+			memcpy(data, array->data, kept);
+			munmap(array->data, old_length);
+		}
+#endif
+		if (data == MAP_FAILED) {
+			printf("mremap failed\n");
+			return false;
+		}
+		array_stats_realloc(array, 0);
+	} else {
+		data = array_huge_map(length);
+		if (data == MAP_FAILED) {
+			printf("mmap failed\n");
+			return false;
+		}
+		memcpy(data, array->data, kept);
+		if (!array_is_inline(array)) {
+			array_deallocate(&array->allocator, array->data,
+					array->capacity * element_size);
+		}
+		array_stats_realloc(array, kept);
+		array->huge = true;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (array->huge) {
+		madvise(data, length, MADV_HUGEPAGE);
+	}
+#endif
+	array->data = data;
+	array->capacity = capacity;
+	return true;
+}
+
+static void array_huge_unmap(Array *array) {
+	munmap(array->data, array_huge_length(array, array->capacity));
+}
+#else
+static bool array_wants_huge(Array *array, size_t capacity) {
+	return false;
+}
+
+static bool array_huge_resize(Array *array, size_t capacity) {
+	return false;
+}
+
+static void array_huge_unmap(Array *array) {
+}
+#endif
+
+// Moves data to a buffer of new_capacity elements, zeroing any new slots.
+// Buffers that fit in the header go back there.
+static bool array_realloc(Array *array, size_t new_capacity) {
+	if (!array_own(array) || !array_linearize(array)) {
+		return false;
+	}
+
+#ifdef ARRAY_MMAP
+	if (array->mapping) {
+		// mremap moves pages, not bytes
+		array_stats_realloc(array, 0);
+		return array_mapping_resize(array, new_capacity);
+	}
+#endif
+	if (array->huge || array_wants_huge(array, new_capacity)) {
+		return array_huge_resize(array, new_capacity);
+	}
+
+	size_t element_size = array->element_size;
+	array_stats_realloc(array, element_size *
+			(new_capacity < array->capacity ? new_capacity : array->capacity));
+	void *data;
+	if (new_capacity <= array->inline_capacity) {
+		data = array_inline_data(array);
+		if (!array_is_inline(array)) {
+			memcpy(data, array->data, new_capacity * element_size);
+			array_deallocate(&array->allocator, array->data,
+					array->capacity * element_size);
+		}
+	} else if (array_is_inline(array)) {
+		data = array_data_allocate(array, new_capacity * element_size);
+		if (!data) {
+			printf("malloc failed\n");
+			return false;
+		}
+		memcpy(data, array->data, array->capacity * element_size);
+	} else {
+		data = array_data_reallocate(array, array->data,
+				array->capacity * element_size, new_capacity * element_size);
+		if (!data) {
+			printf("realloc failed\n");
+			return false;
+		}
+	}
+
+	array->data = data;
+	if (new_capacity > array->capacity) {
+		memset((char *)data + array->capacity * element_size, 0,
+				(new_capacity - array->capacity) * element_size);
+	}
+	array->capacity = new_capacity;
+	return true;
+}
+
+// Everything but where data lives
+static void array_init(Array *array, size_t type_size) {
+	array->size = 0;
+	array->capacity = MIN_CAPACITY;
+	array->element_size = type_size;
+	array->element_free = NULL;
+	array->growth_policy = ARRAY_GROWTH_DEFAULT;
+	array->reserved = 0;
+	array->head = 0;
+	array->deque = false;
+	array->order = NULL;
+	array->index = NULL;
+	array->allocator = (ArrayAllocator){ 0 };
+	array->inline_capacity = 0;
+	array->mapping = NULL;
+	array->alignment = 0;
+	array->huge_pages = false;
+	array->huge = false;
+	array->copy_on_write = false;
+	array->shared = NULL;
+#ifdef ARRAY_STATS
+	array->stats = NULL;
+#endif
+}
+
+static Array *array_create(size_t type_size, const ArrayAllocator *allocator,
+		size_t alignment);
+
+Array *_array_new(size_t type_size) {
+	return _array_new_with_allocator(type_size, NULL);
+}
+
+Array *_array_new_with_allocator(size_t type_size,
+		const ArrayAllocator *allocator) {
+	return array_create(type_size, allocator, 0);
+}
+
+Array *_array_new_aligned(size_t type_size, size_t alignment) {
+	if (alignment & (alignment - 1)) {
+		printf("alignment has to be a power of two\n");
+		return NULL;
+	}
+	return array_create(type_size, NULL, alignment);
+}
+
+static Array *array_create(size_t type_size, const ArrayAllocator *allocator,
+		size_t alignment) {
+	ArrayAllocator chosen = allocator ? *allocator : (ArrayAllocator){ 0 };
+	size_t inline_capacity = type_size ? ARRAY_INLINE_BYTES / type_size : 0;
+	// The header only promises malloc's alignment
+	if (inline_capacity < MIN_CAPACITY || alignment > ARRAY_ALIGNMENT) {
+		inline_capacity = 0;
+	}
+
+	Array *array = array_allocate(&chosen,
+			array_align(sizeof(Array)) + inline_capacity * type_size);
+	if (!array) {
+		return NULL;
+	}
+
+	array_init(array, type_size);
+	array->allocator = chosen;
+	array->inline_capacity = inline_capacity;
+	array->alignment = alignment;
+	if (inline_capacity) {
+		array->data = array_inline_data(array);
+	} else {
+		array->data = array_data_allocate(array, MIN_CAPACITY * type_size);
+		if (!array->data) {
+			array_deallocate(&chosen, array, sizeof(Array));
+			return NULL;
+		}
+	}
+	// Fine for most platforms, not guaranteed to be 0.0 or NULL ptr technically
+	memset(array->data, 0, MIN_CAPACITY * type_size);
+
+	array_stats_register(array);
+	return array;
+}
+
+Array *_array_new_with_size(size_t type_size, size_t size) {
+	Array *array = _array_new(type_size);
+	array_resize(array, size);
+	return array;
+}
+
+Array *_array_with_capacity(size_t type_size, size_t capacity) {
+	Array *array = _array_new(type_size);
+	if (!array) {
+		return NULL;
+	}
+	array_reserve(array, capacity);
+	return array;
+}
+
+// Sized up front like array_with_capacity, but pops can shrink it, for
+// arrays we fill ourselves (loads, collects)
+static Array *array_new_sized(size_t type_size, size_t capacity) {
+	Array *array = _array_new(type_size);
+	if (!array) {
+		return NULL;
+	}
+	// Plus the free slot past size
+	if (capacity + 1 > array->capacity && !array_realloc(array, capacity + 1)) {
+		array_free(array);
+		return NULL;
+	}
+	return array;
+}
+
+#ifdef ARRAY_MMAP
+Array *array_open_mapped(const char *path, size_t element_size, int flags) {
+	bool read_only = flags & ARRAY_MAP_READ_ONLY;
+	int open_flags = read_only ? O_RDONLY : O_RDWR;
+	if (flags & ARRAY_MAP_CREATE) {
+		open_flags |= O_CREAT;
+	}
+
+	int fd = open(path, open_flags, 0644);
+	if (fd < 0) {
+		printf("open failed\n");
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	// New files get a header and at least room for MIN_CAPACITY elements
+	size_t length = info.st_size;
+	bool created = length == 0 && !read_only;
+	if (created) {
+		size_t page_size = array_page_size();
+		length = ARRAY_MAPPED_HEADER + MIN_CAPACITY * element_size;
+		length = (length + page_size - 1) / page_size * page_size;
+		if (ftruncate(fd, length) != 0) {
+			printf("ftruncate failed\n");
+			close(fd);
+			return NULL;
+		}
+	}
+	if (length < ARRAY_MAPPED_HEADER + element_size) {
+		printf("not a mapped array\n");
+		close(fd);
+		return NULL;
+	}
+
+	char *base = mmap(NULL, length, PROT_READ | (read_only ? 0 : PROT_WRITE),
+			MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		printf("mmap failed\n");
+		close(fd);
+		return NULL;
+	}
+
+	ArrayMappedHeader *header = (ArrayMappedHeader *)base;
+	size_t capacity = (length - ARRAY_MAPPED_HEADER) / element_size;
+	if (created) {
+		memcpy(header->magic, ARRAY_MAPPED_MAGIC, sizeof(header->magic));
+		header->element_size = element_size;
+		header->size = 0;
+	} else if (memcmp(header->magic, ARRAY_MAPPED_MAGIC, sizeof(header->magic)) != 0 ||
+			header->element_size != element_size || header->size > capacity) {
+		printf("not a mapped array of this element size\n");
+		munmap(base, length);
+		close(fd);
+		return NULL;
+	}
+
+	Array *array = malloc(sizeof(Array));
+	ArrayMapping *mapping = malloc(sizeof(ArrayMapping));
+	if (!array || !mapping) {
+		printf("malloc failed\n");
+		free(array);
+		free(mapping);
+		munmap(base, length);
+		close(fd);
+		return NULL;
+	}
+
+	*mapping = (ArrayMapping){ fd, base, length, read_only };
+	array_init(array, element_size);
+	array->mapping = mapping;
+	array->data = base + ARRAY_MAPPED_HEADER;
+	array->size = header->size;
+	array->capacity = capacity;
+	// Don't give back file space on pops, and keep the free slot past size
+	array->growth_policy = ARRAY_GROWTH_NEVER_SHRINK;
+	array_stats_register(array);
+	if (!read_only && array->size >= array->capacity) {
+		array_scale_capacity(array);
+	}
+	return array;
+}
+
+bool array_sync(Array *array) {
+	ArrayMapping *mapping = array->mapping;
+	if (!mapping || mapping->read_only) {
+		return true;
+	}
+
+	// The file holds elements in order, a deque may have wrapped them
+	if (!array_linearize(array)) {
+		return false;
+	}
+	((ArrayMappedHeader *)mapping->base)->size = array->size;
+	if (msync(mapping->base, mapping->length, MS_SYNC) != 0) {
+		printf("msync failed\n");
+		return false;
+	}
+	return true;
+}
+
+// Leaves the size in the file for the next open, the kernel writes the
+// pages back whenever it likes
+static void array_unmap(Array *array) {
+	ArrayMapping *mapping = array->mapping;
+	if (!mapping->read_only && array_linearize(array)) {
+		((ArrayMappedHeader *)mapping->base)->size = array->size;
+	}
+	munmap(mapping->base, mapping->length);
+	close(mapping->fd);
+	free(mapping);
+}
+#else
+Array *array_open_mapped(const char *path, size_t element_size, int flags) {
+	printf("mmap isn't supported on this platform\n");
+	return NULL;
+}
+
+bool array_sync(Array *array) {
+	return true;
+}
+
+static void array_unmap(Array *array) {
+}
+#endif
+
+bool array_is_mapped(Array *array) {
+	return array->mapping;
+}
+
+void array_free(Array *array) {
+	if (!array) {
+		return;
+	}
+
+	// Optionally free elements that are heap allocated, unless a
+	// copy-on-write duplicate still has them
+	if (array->element_free && !array_shared_with_others(array)) {
+		for (size_t i = 0; i < array->size; i++) {
+			if (!_array_at(array, i)) {
+				continue;
+			}
+			array->element_free(_array_at(array, i));
+		}
+	}
+
+	array_disable_index(array);
+	array_stats_unregister(array);
+	if (array->mapping) {
+		array_unmap(array);
+	}
+
+	ArrayAllocator allocator = array->allocator;
+	if (array->huge) {
+		array_huge_unmap(array);
+	} else if (!array_is_inline(array) && !array->mapping &&
+			!array_release(array)) {
+		array_deallocate(&allocator, array->data,
+				array->capacity * array->element_size);
+	}
+	array_deallocate(&allocator, array, array_align(sizeof(Array)) +
+			array->inline_capacity * array->element_size);
+}
+
+void array_set_element_free(Array *array, void (*p_element_free)(void *)) {
+	array->element_free = p_element_free;
+}
+
+void array_set_copy_on_write(Array *array, bool copy_on_write) {
+	array->copy_on_write = copy_on_write;
+}
+
+bool array_is_shared(Array *array) {
+	return array_shared_with_others(array);
+}
+
+// O(1) duplicate pointing at array's data. NULL if the data can't be shared
+// (inline, mapped, huge pages), the caller copies instead.
+static Array *array_share(Array *array) {
+	if (array_is_inline(array) || array->mapping || array->huge ||
+			!array_linearize(array)) {
+		return NULL;
+	}
+
+	Array *duplicate = array_create(array->element_size, &array->allocator,
+			array->alignment);
+	if (!duplicate) {
+		return NULL;
+	}
+	if (!array->shared) {
+		array->shared = malloc(sizeof(ArrayShared));
+		if (!array->shared) {
+			printf("malloc failed\n");
+			array_free(duplicate);
+			return NULL;
+		}
+		atomic_init(&array->shared->references, 1);
+	}
+
+	if (!array_is_inline(duplicate)) {
+		array_deallocate(&duplicate->allocator, duplicate->data,
+				duplicate->capacity * duplicate->element_size);
+	}
+	atomic_fetch_add(&array->shared->references, 1);
+	duplicate->shared = array->shared;
+	duplicate->data = array->data;
+	duplicate->size = array->size;
+	duplicate->capacity = array->capacity;
+	duplicate->element_free = array->element_free;
+	duplicate->copy_on_write = true;
+	return duplicate;
+}
+
+Array *array_duplicate(Array *array) {
+	return array_duplicate_custom(array, NULL);
+}
+
+Array *array_duplicate_custom(Array *array,
+		void (*element_duplicate)(void *, void *)) {
+	if (array->copy_on_write && !element_duplicate) {
+		Array *duplicate = array_share(array);
+		if (duplicate) {
+			return duplicate;
+		}
+	}
+
+	Array *duplicate = _array_new_with_allocator(array->element_size,
+			&array->allocator);
+	array_resize(duplicate, array->size);
+	duplicate->element_free = array->element_free;
+
+	array_stats_moved(duplicate, array->size * array->element_size);
+	for (size_t i = 0; i < array->size; i++) {
+		if (!element_duplicate) {
+			memcpy(_array_at(duplicate, i), _array_at(array, i), array->element_size);
+		} else {
+			element_duplicate(_array_at(duplicate, i), _array_at(array, i));
+		}
+	}
+	return duplicate;
+}
+
+size_t array_size(Array *array) {
+	return array->size;
+}
+
+size_t array_capacity(Array *array) {
+	return array->capacity;
+}
+
+size_t array_element_size(Array *array) {
+	return array->element_size;
+}
+
+void *array_element_free(Array *array) {
+	return array->element_free;
+}
+
+// For reading, doesn't copy shared data
+static void *array_contiguous(Array *array) {
+	// A wrapped deque has to be made contiguous first
+	array_linearize(array);
+	return array->data;
+}
+
+void *array_data(Array *array) {
+	// Callers can write through it, so it can't be shared anymore
+	array_own(array);
+	return array_contiguous(array);
+}
+
+bool array_empty(Array *array) {
+	return array->size == 0;
+}
+
+#ifdef ARRAY_SIMD_X86
+// Turns a byte mask from cmpeq_epi8 into one bit per fully matching element,
+// sitting on that element's first byte
+static inline __attribute__((always_inline)) uint32_t array_fold_mask(
+		uint32_t mask, size_t element_size) {
+	for (size_t shift = 1; shift < element_size; shift <<= 1) {
+		mask &= mask >> shift;
+	}
+	switch (element_size) {
+		case 2:
+			return mask & 0x55555555u;
+		case 4:
+			return mask & 0x11111111u;
+		case 8:
+			return mask & 0x01010101u;
+		case 16:
+			return mask & 0x00010001u;
+	}
+	return mask;
+}
+
+// Scans whole 32 byte blocks. Returns the index of the first match, or the
+// first index it didn't look at. Counts every match instead if count is set.
+__attribute__((target("avx2"))) static inline __attribute__((always_inline))
+size_t array_scan_avx2(const char *data, size_t n, const void *element,
+		size_t element_size, size_t *count) {
+	unsigned char pattern[32];
+	for (size_t j = 0; j < 32; j += element_size) {
+		memcpy(pattern + j, element, element_size);
+	}
+	__m256i needle = _mm256_loadu_si256((const __m256i *)pattern);
+
+	size_t step = 32 / element_size;
+	size_t i = 0;
+	for (; i + step <= n; i += step) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(data + i * element_size));
+		uint32_t mask = array_fold_mask(
+				(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)),
+				element_size);
+		if (count) {
+			*count += __builtin_popcount(mask);
+		} else if (mask) {
+			return i + __builtin_ctz(mask) / element_size;
+		}
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t array_scan_avx2_dispatch(
+		const char *data, size_t n, const void *element, size_t element_size,
+		size_t *count) {
+	// Constant element sizes let each case unroll the mask folding
+	switch (element_size) {
+		case 1:
+			return array_scan_avx2(data, n, element, 1, count);
+		case 2:
+			return array_scan_avx2(data, n, element, 2, count);
+		case 4:
+			return array_scan_avx2(data, n, element, 4, count);
+		case 8:
+			return array_scan_avx2(data, n, element, 8, count);
+		case 16:
+			return array_scan_avx2(data, n, element, 16, count);
+	}
+	return 0;
+}
+
+#ifdef __SSE2__
+// Same as array_scan_avx2 with 16 byte blocks
+static inline __attribute__((always_inline)) size_t array_scan_sse2(
+		const char *data, size_t n, const void *element, size_t element_size,
+		size_t *count) {
+	unsigned char pattern[16];
+	for (size_t j = 0; j < 16; j += element_size) {
+		memcpy(pattern + j, element, element_size);
+	}
+	__m128i needle = _mm_loadu_si128((const __m128i *)pattern);
+
+	size_t step = 16 / element_size;
+	size_t i = 0;
+	for (; i + step <= n; i += step) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(data + i * element_size));
+		uint32_t mask = array_fold_mask(
+				(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)),
+				element_size);
+		if (count) {
+			*count += __builtin_popcount(mask);
+		} else if (mask) {
+			return i + __builtin_ctz(mask) / element_size;
+		}
+	}
+	return i;
+}
+
+static size_t array_scan_sse2_dispatch(const char *data, size_t n,
+		const void *element, size_t element_size, size_t *count) {
+	switch (element_size) {
+		case 1:
+			return array_scan_sse2(data, n, element, 1, count);
+		case 2:
+			return array_scan_sse2(data, n, element, 2, count);
+		case 4:
+			return array_scan_sse2(data, n, element, 4, count);
+		case 8:
+			return array_scan_sse2(data, n, element, 8, count);
+		case 16:
+			return array_scan_sse2(data, n, element, 16, count);
+	}
+	return 0;
+}
+#endif
+#endif
+
+// Finds the first element bytewise equal to element in n contiguous ones,
+// returns n if there isn't one. With count set, adds up every match instead.
+static size_t array_scan(const char *data, size_t n, const void *element,
+		size_t element_size, size_t *count) {
+	size_t i = 0;
+
+#ifdef ARRAY_SIMD_X86
+	bool vectorizable = element_size <= 16 &&
+			(element_size & (element_size - 1)) == 0;
+	if (vectorizable && __builtin_cpu_supports("avx2")) {
+		i = array_scan_avx2_dispatch(data, n, element, element_size, count);
+	}
+#ifdef __SSE2__
+	else if (vectorizable) {
+		i = array_scan_sse2_dispatch(data, n, element, element_size, count);
+	}
+#endif
+#endif
+
+	// Leftovers, and a find that stopped on a match hits it straight away
+	for (; i < n; i++) {
+		if (memcmp(data + i * element_size, element, element_size) == 0) {
+			if (!count) {
+				return i;
+			}
+			(*count)++;
+		}
+	}
+	return n;
+}
+
+// array_scan over both halves of a wrapped deque
+static ptrdiff_t array_find_bytes(Array *array, void *element, size_t *count) {
+	size_t first = array->capacity - array->head;
+	first = first < array->size ? first : array->size;
+
+	size_t i = array_scan(_array_unsafe_at(array, 0), first, element,
+			array->element_size, count);
+	if (!count && i < first) {
+		return i;
+	}
+
+	size_t second = array->size - first;
+	size_t j = array_scan(array->data, second, element, array->element_size,
+			count);
+	if (!count && j < second) {
+		return first + j;
+	}
+	return -1;
+}
+
+ptrdiff_t array_find(Array *array, void *element) {
+	return array_find_custom(array, NULL, element);
+}
+
+ptrdiff_t array_find_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	array_stats_call(array, ARRAY_OP_FIND);
+	if (array_index_usable(array, compare)) {
+		return array_index_find(array, element, NULL);
+	}
+	if (!compare) {
+		return array_find_bytes(array, element, NULL);
+	}
+	if (compare == array->order) {
+		return array_bsearch_custom(array, compare, element);
+	}
+	for (size_t i = 0; i < array->size; i++) {
+		if (compare(_array_at(array, i), element) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool array_contains(Array *array, void *element) {
+	return array_find(array, element) != -1;
+}
+
+bool array_contains_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	return array_find_custom(array, compare, element) != -1;
+}
+
+size_t array_count(Array *array, void *element) {
+	return array_count_custom(array, NULL, element);
+}
+
+size_t array_count_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	array_stats_call(array, ARRAY_OP_FIND);
+	size_t count = 0;
+	if (array_index_usable(array, compare)) {
+		array_index_find(array, element, &count);
+		return count;
+	}
+	if (!compare) {
+		array_find_bytes(array, element, &count);
+		return count;
+	}
+	if (compare == array->order) {
+		return array_upper_bound_custom(array, compare, element) -
+				array_lower_bound_custom(array, compare, element);
+	}
+	for (size_t i = 0; i < array->size; i++) {
+		if (compare(_array_at(array, i), element) == 0) {
+			count++;
+		}
+	}
+	return count;
+}
+
+void array_clear(Array *array) {
+	// Other duplicates keep the elements, nothing needs copying
+	if (array_shared_with_others(array)) {
+		array->size = 0;
+	}
+	if (!array_own(array)) {
+		return;
+	}
+
+	if (array->element_free) {
+		for (size_t i = 0; i < array->size; i++) {
+			array->element_free(_array_at(array, i));
+		}
+	}
+
+	if (array->index) {
+		memset(array->index->slots, 0xFF,
+				(array->index->mask + 1) * sizeof(size_t));
+		array->index->count = 0;
+		array->index->stale = false;
+	}
+
+	// A reservation is given back like everything else
+	array->reserved = 0;
+
+	// Arrays that never shrink keep their buffer for the next fill
+	if (array->growth_policy.shrink_threshold <= 0.0) {
+		array->size = 0;
+		array->head = 0;
+		return;
+	}
+
+	size_t min_capacity = array->growth_policy.min_capacity;
+	if (array->mapping || array->huge) {
+		array->size = 0;
+		array->head = 0;
+		array_realloc(array, min_capacity);
+		return;
+	}
+
+	void *temp = min_capacity <= array->inline_capacity
+			? array_inline_data(array)
+			: array_data_allocate(array, min_capacity * array->element_size);
+	if (!temp) {
+		printf("calloc failed\n");
+		return;
+	}
+
+	if (!array_is_inline(array)) {
+		array_deallocate(&array->allocator, array->data,
+				array->capacity * array->element_size);
+	}
+	memset(temp, 0, min_capacity * array->element_size);
+
+	array->size = 0;
+	array->capacity = min_capacity;
+	array->head = 0;
+	array->data = temp;
+}
+//
+void array_reverse(Array *array) {
+	if (!array_own(array)) {
+		return;
+	}
+	array->order = NULL;
+	array_stats_moved(array, 3 * (array->size / 2) * array->element_size);
+	for (size_t i = 0; i < array->size / 2; i++) {
+		memcpy(_array_unsafe_at(array, array->size), _array_at(array, i),
+				array->element_size);
+		memcpy(_array_at(array, i), _array_at(array, -1 - i), array->element_size);
+		memcpy(_array_at(array, -1 - i), _array_unsafe_at(array, array->size),
+				array->element_size);
+	}
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+}
+
+// How elements get ordered, a comparator or else a key type from array_sort
+typedef struct ArrayOrder {
+	int (*compare)(void *, void *);
+	ArrayKey key;
+	size_t element_size;
+	// Flips the order, for biggest first
+	bool reverse;
+} ArrayOrder;
+
+static ArrayOrder array_order(Array *array, int (*compare)(void *, void *),
+		ArrayKey key) {
+	size_t element_size = array->element_size;
+	bool integer_size = element_size == 1 || element_size == 2 ||
+			element_size == 4 || element_size == 8;
+	if (!integer_size) {
+		key = ARRAY_KEY_BYTES;
+	}
+	return (ArrayOrder){ compare, key, element_size, false };
+}
+
+// Maps numbers to unsigned keys that sort the same way, so radix sort and
+// comparisons only ever deal with unsigned integers
+static inline __attribute__((always_inline)) uint64_t array_radix_key(
+		const void *element, size_t size, ArrayKey key) {
+	uint64_t bits = 0;
+	switch (size) {
+		case 1: {
+			uint8_t value;
+			memcpy(&value, element, 1);
+			bits = value;
+		} break;
+		case 2: {
+			uint16_t value;
+			memcpy(&value, element, 2);
+			bits = value;
+		} break;
+		case 4: {
+			uint32_t value;
+			memcpy(&value, element, 4);
+			bits = value;
+		} break;
+		case 8:
+			memcpy(&bits, element, 8);
+			break;
+	}
+
+	uint64_t sign = (uint64_t)1 << (size * 8 - 1);
+	if (key == ARRAY_KEY_SIGNED) {
+		bits ^= sign;
+	} else if (key == ARRAY_KEY_FLOAT) {
+		// Negative floats sort backwards, flip all their bits
+		bits = bits & sign ? ~bits & (sign | (sign - 1)) : bits | sign;
+	}
+	return bits;
+}
+
+static inline int array_order_compare(ArrayOrder *order, void *a, void *b) {
+	if (order->reverse) {
+		void *swap = a;
+		a = b;
+		b = swap;
+	}
+	if (order->compare) {
+		return order->compare(a, b);
+	}
+	if (order->key == ARRAY_KEY_BYTES) {
+		return memcmp(a, b, order->element_size);
+	}
+	uint64_t x = array_radix_key(a, order->element_size, order->key);
+	uint64_t y = array_radix_key(b, order->element_size, order->key);
+	return (x > y) - (x < y);
+}
+
+static void array_swap_bytes(char *a, char *b, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		char temp = a[i];
+		a[i] = b[i];
+		b[i] = temp;
+	}
+}
+
+static void array_insertion_sort(char *data, size_t n, ArrayOrder *order,
+		char *temp) {
+	size_t element_size = order->element_size;
+	for (size_t i = 1; i < n; i++) {
+		char *element = data + i * element_size;
+		size_t j = i;
+		while (j > 0 && array_order_compare(order, data + (j - 1) * element_size, element) > 0) {
+			j--;
+		}
+		if (j != i) {
+			memcpy(temp, element, element_size);
+			memmove(data + (j + 1) * element_size, data + j * element_size,
+					(i - j) * element_size);
+			memcpy(data + j * element_size, temp, element_size);
+		}
+	}
+}
+
+static void array_sift_down(char *data, size_t root, size_t n,
+		ArrayOrder *order) {
+	size_t element_size = order->element_size;
+	for (size_t child = 2 * root + 1; child < n; child = 2 * root + 1) {
+		if (child + 1 < n && array_order_compare(order, data + child * element_size, data + (child + 1) * element_size) < 0) {
+			child++;
+		}
+		if (array_order_compare(order, data + root * element_size, data + child * element_size) >= 0) {
+			return;
+		}
+		array_swap_bytes(data + root * element_size, data + child * element_size,
+				element_size);
+		root = child;
+	}
+}
+
+static void array_heap_sort(char *data, size_t n, ArrayOrder *order) {
+	for (size_t i = n / 2; i-- > 0;) {
+		array_sift_down(data, i, n, order);
+	}
+	for (size_t end = n - 1; end > 0; end--) {
+		array_swap_bytes(data, data + end * order->element_size,
+				order->element_size);
+		array_sift_down(data, 0, end, order);
+	}
+}
+
+// Splits n > 2 elements around a median of three pivot. Returns how many
+// ended up on the left, nothing there is greater than anything right of it
+// and neither side is empty.
+static size_t array_partition(char *data, size_t n, ArrayOrder *order,
+		char *pivot) {
+	size_t element_size = order->element_size;
+
+	// Median of three, which also keeps the scans below in bounds
+	char *first = data;
+	char *middle = data + (n / 2) * element_size;
+	char *last = data + (n - 1) * element_size;
+	if (array_order_compare(order, middle, first) < 0) {
+		array_swap_bytes(middle, first, element_size);
+	}
+	if (array_order_compare(order, last, middle) < 0) {
+		array_swap_bytes(last, middle, element_size);
+		if (array_order_compare(order, middle, first) < 0) {
+			array_swap_bytes(middle, first, element_size);
+		}
+	}
+	memcpy(pivot, middle, element_size);
+
+	// Hoare partition
+	size_t i = 0;
+	size_t j = n - 1;
+	while (true) {
+		while (array_order_compare(order, data + i * element_size, pivot) < 0) {
+			i++;
+		}
+		while (array_order_compare(order, pivot, data + j * element_size) < 0) {
+			j--;
+		}
+		if (i >= j) {
+			break;
+		}
+		array_swap_bytes(data + i * element_size, data + j * element_size,
+				element_size);
+		i++;
+		j--;
+	}
+	return j + 1;
+}
+
+// Quicksort that gives up on bad pivots after depth levels and heap sorts
+// instead, with insertion sort for the small ranges left at the bottom
+static void array_introsort(char *data, size_t n, ArrayOrder *order,
+		size_t depth, char *pivot) {
+	size_t element_size = order->element_size;
+
+	while (n > 16) {
+		if (depth-- == 0) {
+			array_heap_sort(data, n, order);
+			return;
+		}
+
+		// Recurse into the smaller side, loop on the bigger one
+		size_t left = array_partition(data, n, order, pivot);
+		size_t right = n - left;
+		if (left < right) {
+			array_introsort(data, left, order, depth, pivot);
+			data += left * element_size;
+			n = right;
+		} else {
+			array_introsort(data + left * element_size, right, order, depth, pivot);
+			n = left;
+		}
+	}
+
+	array_insertion_sort(data, n, order, pivot);
+}
+
+// Quickselect, only following the side nth is on. Same bad pivot escape
+// hatch as introsort.
+static void array_introselect(char *data, size_t n, size_t nth,
+		ArrayOrder *order, size_t depth, char *pivot) {
+	size_t element_size = order->element_size;
+
+	while (n > 16) {
+		if (depth-- == 0) {
+			array_heap_sort(data, n, order);
+			return;
+		}
+
+		size_t left = array_partition(data, n, order, pivot);
+		if (nth < left) {
+			n = left;
+		} else {
+			data += left * element_size;
+			nth -= left;
+			n -= left;
+		}
+	}
+
+	array_insertion_sort(data, n, order, pivot);
+}
+
+// 2 log2(n) levels before giving up on quicksort
+static size_t array_sort_depth(size_t n) {
+	size_t depth = 0;
+	for (; n > 1; n >>= 1) {
+		depth += 2;
+	}
+	return depth;
+}
+
+static void array_sort_order(Array *array, ArrayOrder *order) {
+	if (array->size < 2) {
+		return;
+	}
+
+	char *pivot = malloc(order->element_size);
+	if (!pivot) {
+		printf("malloc failed\n");
+		return;
+	}
+
+	array_introsort(array_data(array), array->size, order,
+			array_sort_depth(array->size), pivot);
+	free(pivot);
+}
+
+// LSD radix sort a byte at a time. All the histograms come from one pass,
+// bytes every element agrees on are skipped.
+static inline __attribute__((always_inline)) bool array_radix_sort_n(
+		char *data, size_t n, size_t element_size, ArrayKey key) {
+	size_t (*counts)[256] = calloc(element_size, sizeof(*counts));
+	char *temp = malloc(n * element_size);
+	if (!counts || !temp) {
+		free(counts);
+		free(temp);
+		return false;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		uint64_t bits = array_radix_key(data + i * element_size, element_size, key);
+		for (size_t byte = 0; byte < element_size; byte++) {
+			counts[byte][(bits >> (byte * 8)) & 0xFF]++;
+		}
+	}
+
+	char *source = data;
+	char *destination = temp;
+	for (size_t byte = 0; byte < element_size; byte++) {
+		size_t *count = counts[byte];
+		uint64_t first = (array_radix_key(source, element_size, key) >> (byte * 8)) & 0xFF;
+		if (count[first] == n) {
+			continue;
+		}
+
+		size_t offset = 0;
+		for (size_t digit = 0; digit < 256; digit++) {
+			size_t c = count[digit];
+			count[digit] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			char *element = source + i * element_size;
+			uint64_t bits = array_radix_key(element, element_size, key);
+			size_t to = count[(bits >> (byte * 8)) & 0xFF]++;
+			memcpy(destination + to * element_size, element, element_size);
+		}
+
+		char *swap = source;
+		source = destination;
+		destination = swap;
+	}
+
+	if (source != data) {
+		memcpy(data, source, n * element_size);
+	}
+	free(counts);
+	free(temp);
+	return true;
+}
+
+static bool array_radix_sort(char *data, size_t n, size_t element_size,
+		ArrayKey key) {
+	switch (element_size) {
+		case 1:
+			return array_radix_sort_n(data, n, 1, key);
+		case 2:
+			return array_radix_sort_n(data, n, 2, key);
+		case 4:
+			return array_radix_sort_n(data, n, 4, key);
+		case 8:
+			return array_radix_sort_n(data, n, 8, key);
+	}
+	return false;
+}
+
+void _array_sort(Array *array, ArrayKey key) {
+	array_stats_call(array, ARRAY_OP_SORT);
+	ArrayOrder order = array_order(array, NULL, key);
+	array->order = NULL;
+
+	// Radix sort needs a second buffer, not worth it for small arrays
+	if (order.key == ARRAY_KEY_BYTES || array->size < ARRAY_RADIX_THRESHOLD ||
+			!array_radix_sort(array_data(array), array->size, order.element_size,
+					order.key)) {
+		array_sort_order(array, &order);
+	}
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+}
+
+void array_sort_custom(Array *array, int (*compare)(void *, void *)) {
+	array_stats_call(array, ARRAY_OP_SORT);
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	array->order = NULL;
+	array_sort_order(array, &order);
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+}
+
+// Puts the first n elements in order, the n smallest
+static void array_partial_sort_order(Array *array, size_t n,
+		ArrayOrder *order) {
+	array_stats_call(array, ARRAY_OP_SORT);
+	array->order = NULL;
+	n = n < array->size ? n : array->size;
+	if (n == 0) {
+		return;
+	}
+
+	char *pivot = malloc(order->element_size);
+	if (!pivot) {
+		printf("malloc failed\n");
+		return;
+	}
+
+	char *data = array_data(array);
+	array_introselect(data, array->size, n - 1, order,
+			array_sort_depth(array->size), pivot);
+	array_introsort(data, n - 1, order, array_sort_depth(n - 1), pivot);
+	free(pivot);
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+}
+
+static void *array_nth_element_order(Array *array, ptrdiff_t n,
+		ArrayOrder *order) {
+	if (!_array_at(array, n)) {
+		return NULL;
+	}
+	n = n < 0 ? n + array->size : n;
+
+	array_stats_call(array, ARRAY_OP_SORT);
+	array->order = NULL;
+	char *pivot = malloc(order->element_size);
+	if (!pivot) {
+		printf("malloc failed\n");
+		return NULL;
+	}
+	array_introselect(array_data(array), array->size, n, order,
+			array_sort_depth(array->size), pivot);
+	free(pivot);
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+	return _array_at(array, n);
+}
+
+void *_array_nth_element(Array *array, ArrayKey key, ptrdiff_t n) {
+	ArrayOrder order = array_order(array, NULL, key);
+	return array_nth_element_order(array, n, &order);
+}
+
+void *array_nth_element_custom(Array *array, int (*compare)(void *, void *),
+		ptrdiff_t n) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	return array_nth_element_order(array, n, &order);
+}
+
+void _array_partial_sort(Array *array, ArrayKey key, size_t n) {
+	ArrayOrder order = array_order(array, NULL, key);
+	array_partial_sort_order(array, n, &order);
+}
+
+void array_partial_sort_custom(Array *array, int (*compare)(void *, void *),
+		size_t n) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	array_partial_sort_order(array, n, &order);
+}
+
+// One pass over array collecting anything bigger than the kth largest seen
+// so far into a 2k buffer in out. Whenever it fills, introselect keeps the
+// top k and raises the bar. Unlike a heap, sorted input stays O(n). A
+// reversed order keeps the k smallest instead.
+static void array_top_k_order(Array *array, size_t k, Array *out,
+		ArrayOrder *order) {
+	if (array == out || array->element_size != out->element_size) {
+		printf("top_k needs a separate out with the same element_size\n");
+		return;
+	}
+	if (!array_own(out)) {
+		return;
+	}
+	out->order = NULL;
+
+	// Whatever out held is overwritten
+	if (out->element_free) {
+		for (size_t i = 0; i < out->size; i++) {
+			out->element_free(_array_unsafe_at(out, i));
+		}
+	}
+	k = k < array->size ? k : array->size;
+	size_t limit = k < array->size - k ? 2 * k : array->size;
+	out->size = limit;
+	array_scale_capacity(out);
+	if (k == 0 || !array_linearize(out)) {
+		out->size = 0;
+		array_scale_capacity(out);
+		return;
+	}
+
+	size_t element_size = array->element_size;
+	char *pivot = malloc(element_size);
+	if (!pivot) {
+		printf("malloc failed\n");
+		out->size = 0;
+		return;
+	}
+
+	// Biggest first, so "smallest" under reversed is what gets kept
+	ArrayOrder reversed = *order;
+	reversed.reverse = !order->reverse;
+	char *buffer = out->data;
+	char *data = array_contiguous(array);
+	// Numbers compare as cached unsigned keys, no comparator calls.
+	// Flipping every bit reverses them.
+	bool keyed = !order->compare && order->key != ARRAY_KEY_BYTES;
+	uint64_t flip = order->reverse ? UINT64_MAX : 0;
+	uint64_t bar = 0;
+	char *bar_element = NULL;
+
+	size_t count = 0;
+	for (size_t i = 0; i < array->size; i++) {
+		char *element = data + i * element_size;
+		if (bar_element && (keyed
+				? (array_radix_key(element, element_size, order->key) ^ flip) <= bar
+				: array_order_compare(order, element, bar_element) <= 0)) {
+			continue;
+		}
+		memcpy(buffer + count * element_size, element, element_size);
+		if (++count < limit) {
+			continue;
+		}
+
+		array_introselect(buffer, count, k - 1, &reversed,
+				array_sort_depth(count), pivot);
+		count = k;
+		bar_element = buffer + (k - 1) * element_size;
+		if (keyed) {
+			bar = array_radix_key(bar_element, element_size, order->key) ^ flip;
+		}
+	}
+
+	if (count > k) {
+		array_introselect(buffer, count, k - 1, &reversed,
+				array_sort_depth(count), pivot);
+		count = k;
+	}
+	array_introsort(buffer, count, &reversed, array_sort_depth(count), pivot);
+	free(pivot);
+
+	out->size = count;
+	array_scale_capacity(out);
+	array_stats_moved(out, count * element_size);
+	if (out->index) {
+		array_index_rebuild(out);
+	}
+}
+
+void _array_top_k(Array *array, ArrayKey key, size_t k, Array *out) {
+	ArrayOrder order = array_order(array, NULL, key);
+	array_top_k_order(array, k, out, &order);
+}
+
+void array_top_k_custom(Array *array, int (*compare)(void *, void *),
+		size_t k, Array *out) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	array_top_k_order(array, k, out, &order);
+}
+
+void _array_bottom_k(Array *array, ArrayKey key, size_t k, Array *out) {
+	ArrayOrder order = array_order(array, NULL, key);
+	order.reverse = true;
+	array_top_k_order(array, k, out, &order);
+}
+
+void array_bottom_k_custom(Array *array, int (*compare)(void *, void *),
+		size_t k, Array *out) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	order.reverse = true;
+	array_top_k_order(array, k, out, &order);
+}
+
+// First index whose element isn't less than element, or with upper set,
+// the first one that's greater
+static size_t array_bound(Array *array, ArrayOrder *order, void *element,
+		bool upper) {
+	size_t low = 0;
+	size_t high = array->size;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		int diff = array_order_compare(order, _array_at(array, middle), element);
+		if (diff < 0 || (upper && diff == 0)) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+static ptrdiff_t array_bsearch_order(Array *array, ArrayOrder *order,
+		void *element) {
+	size_t index = array_bound(array, order, element, false);
+	if (index < array->size &&
+			array_order_compare(order, _array_at(array, index), element) == 0) {
+		return index;
+	}
+	return -1;
+}
+
+ptrdiff_t _array_bsearch(Array *array, ArrayKey key, void *element) {
+	ArrayOrder order = array_order(array, NULL, key);
+	return array_bsearch_order(array, &order, element);
+}
+
+ptrdiff_t array_bsearch_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	return array_bsearch_order(array, &order, element);
+}
+
+size_t _array_lower_bound(Array *array, ArrayKey key, void *element) {
+	ArrayOrder order = array_order(array, NULL, key);
+	return array_bound(array, &order, element, false);
+}
+
+size_t array_lower_bound_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	return array_bound(array, &order, element, false);
+}
+
+size_t _array_upper_bound(Array *array, ArrayKey key, void *element) {
+	ArrayOrder order = array_order(array, NULL, key);
+	return array_bound(array, &order, element, true);
+}
+
+size_t array_upper_bound_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	ArrayOrder order = array_order(array, compare, ARRAY_KEY_BYTES);
+	return array_bound(array, &order, element, true);
+}
+
+void *array_keep_sorted(Array *array) {
+	return array->order;
+}
+
+void array_set_keep_sorted(Array *array, int (*compare)(void *, void *)) {
+	if (compare) {
+		array_sort_custom(array, compare);
+	}
+	array->order = compare;
+}
+
+void array_insert_sorted(Array *array, void *element) {
+	// After any equal elements, so they stay in insertion order
+	ArrayOrder order = array_order(array, array->order, ARRAY_KEY_BYTES);
+	size_t index = array_bound(array, &order, element, true);
+	int (*kept)(void *, void *) = array->order;
+	array_insert_range(array, index, element, 1);
+	array->order = kept;
+}
+
+void array_resize(Array *array, size_t new_size) {
+	if (!array_own(array)) {
+		return;
+	}
+	array_stats_call(array, ARRAY_OP_RESIZE);
+	size_t old_size = array->size;
+	// New elements are zeroed, wherever that sorts
+	if (new_size > old_size) {
+		array->order = NULL;
+	}
+	if (new_size < old_size) {
+		array_index_drop(array, new_size, old_size);
+	}
+	array->size = new_size;
+
+	if (array->element_free) {
+		for (size_t i = array->size; i < old_size; i++) {
+			array->element_free(_array_unsafe_at(array, i));
+		}
+	}
+
+	array_scale_capacity(array);
+	if (new_size > old_size) {
+		array_index_add(array, old_size, new_size);
+	}
+}
+
+void array_reserve(Array *array, size_t capacity) {
+	// Pops hand back the slot past size, so keep one extra. Remembering it
+	// stops later pops from shrinking the reservation away.
+	capacity++;
+	if (capacity > array->reserved) {
+		array->reserved = capacity;
+	}
+	if (capacity > array->capacity) {
+		array_realloc(array, capacity);
+	}
+}
+
+void array_scale_capacity(Array *array) {
+	array_stats_call(array, ARRAY_OP_SCALE);
+	size_t started = array_stats_now();
+	ArrayGrowthPolicy *policy = &array->growth_policy;
+	size_t capacity = array->capacity;
+
+	if (capacity < policy->min_capacity) {
+		capacity = policy->min_capacity;
+	}
+
+	// Always keep a free slot past size, pops return a pointer to it
+	while (array->size >= capacity) {
+		size_t next = (size_t)(capacity * policy->growth_factor);
+		capacity = next > capacity ? next : capacity + 1;
+	}
+
+	// Shrinking waits for size to fall under the threshold, so pushing and
+	// popping around a boundary doesn't realloc on every call
+	if (array->size < capacity * policy->shrink_threshold) {
+		size_t next = (size_t)(capacity / policy->growth_factor);
+		while (next > array->size && next >= policy->min_capacity &&
+				next >= array->reserved) {
+			capacity = next;
+			next = (size_t)(capacity / policy->growth_factor);
+		}
+	}
+
+	if (capacity != array->capacity) {
+		array_realloc(array, capacity);
+	}
+	array_stats_scaled(array, started);
+}
+
+void array_shrink_to_fit(Array *array) {
+	// Keeps the free slot past size that pops and reverse use, which also
+	// means realloc never gets 0 bytes
+	array->reserved = 0;
+	array_realloc(array, array->size + 1);
+}
+
+bool array_is_deque(Array *array) {
+	return array->deque;
+}
+
+void array_set_deque(Array *array, bool deque) {
+	// Leaving deque mode needs element 0 back at the start of data
+	if (!deque && !array_linearize(array)) {
+		return;
+	}
+	array->deque = deque;
+}
+
+void array_set_huge_pages(Array *array, bool huge_pages) {
+	if (array->mapping) {
+		return;
+	}
+	array->huge_pages = huge_pages;
+	// Move data in or out now rather than on the next resize
+	if (array->huge != array_wants_huge(array, array->capacity)) {
+		array_realloc(array, array->capacity);
+	}
+}
+
+bool array_is_huge(Array *array) {
+	return array->huge;
+}
+
+bool array_enable_index(Array *array, size_t (*hash)(void *),
+		int (*compare)(void *, void *)) {
+	array_disable_index(array);
+
+	ArrayIndex *index = malloc(sizeof(ArrayIndex));
+	if (!index) {
+		printf("malloc failed\n");
+		return false;
+	}
+	*index = (ArrayIndex){ hash, compare, NULL, 0, 0 };
+
+	array->index = index;
+	if (!array_index_rebuild(array)) {
+		array_disable_index(array);
+		return false;
+	}
+	return true;
+}
+
+void array_disable_index(Array *array) {
+	if (!array->index) {
+		return;
+	}
+	free(array->index->slots);
+	free(array->index);
+	array->index = NULL;
+}
+
+void array_rebuild_index(Array *array) {
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+}
+
+bool array_has_index(Array *array) {
+	return array->index != NULL;
+}
+
+ArrayGrowthPolicy array_growth_policy(Array *array) {
+	return array->growth_policy;
+}
+
+void array_set_growth_policy(Array *array, ArrayGrowthPolicy policy) {
+	// Anything that can't grow would loop forever in array_scale_capacity
+	if (policy.growth_factor <= 1.0) {
+		policy.growth_factor = ARRAY_GROWTH_DEFAULT.growth_factor;
+	}
+	if (policy.min_capacity < 1) {
+		policy.min_capacity = 1;
+	}
+	array->growth_policy = policy;
+	array_scale_capacity(array);
+}
+
+void *_array_at(Array *array, ptrdiff_t index) {
+	// Supports Python style negative indexing
+	// TODO: throw error
+	if (index < 0) {
+		index += array->size;
+	}
+	if (index < 0 || index >= array->size) {
+		return NULL;
+	}
+	size_t i = array->head + index;
+	if (i >= array->capacity) {
+		i -= array->capacity;
+	}
+	return (char *)array->data + i * array->element_size;
+}
+
+void *_array_unsafe_at(Array *array, ptrdiff_t index) {
+	// Supports Python style negative indexing
+	if (index < 0) {
+		index += array->size;
+	}
+	size_t i = array->head + index;
+	if (i >= array->capacity) {
+		i -= array->capacity;
+	}
+	return (char *)array->data + i * array->element_size;
+}
+
+void array_set(Array *array, ptrdiff_t index, void *element) {
+	if (!_array_at(array, index) || !array_own(array)) {
+		return;
+	}
+	void *target = _array_at(array, index);
+	array->order = NULL;
+
+	array_stats_call(array, ARRAY_OP_SET);
+	array_stats_moved(array, array->element_size);
+	index = index < 0 ? index + array->size : index;
+	array_index_drop(array, index, index + 1);
+	memcpy(target, element, array->element_size);
+	array_index_add(array, index, index + 1);
+}
+
+void *_array_get(Array *array, ptrdiff_t index) {
+	return _array_at(array, index);
+}
+
+void array_insert_at(Array *array, ptrdiff_t index, void *element) {
+	if (!_array_at(array, index)) {
+		return;
+	}
+	array_insert_range(array, index, element, 1);
+}
+
+void array_remove_at(Array *array, ptrdiff_t index) {
+	if (!_array_at(array, index)) {
+		return;
+	}
+	index = index < 0 ? array->size + index : index;
+	array_remove_range(array, index, index + 1);
+}
+
+void array_insert_range(Array *array, ptrdiff_t index, void *elements,
+		size_t n) {
+	// index == size appends
+	index = index < 0 ? index + array->size : index;
+	if (index < 0 || (size_t)index > array->size || n == 0 ||
+			!array_own(array)) {
+		return;
+	}
+
+	// Only array_insert_sorted keeps the order, it puts it back after
+	array->order = NULL;
+
+	// Grow once and move the tail once, however many elements go in
+	array_stats_call(array, ARRAY_OP_INSERT);
+	size_t tail = array->size - index;
+	array->size += n;
+	array_scale_capacity(array);
+
+	if (array->deque && index == 0) {
+		// Step head back instead of moving everything
+		array->head = (array->head + array->capacity - n) % array->capacity;
+	} else if (tail) {
+		if (!array_linearize(array)) {
+			array->size -= n;
+			return;
+		}
+		array_stats_moved(array, tail * array->element_size);
+		memmove(_array_unsafe_at(array, index + n),
+				_array_unsafe_at(array, index), tail * array->element_size);
+		array_index_shift(array, index, index + tail, n);
+	}
+	array_copy_in(array, index, elements, n);
+	array_index_add(array, index, index + n);
+}
+
+// Everything after the gap moves back once, or at the front of a deque head
+// just steps over it. Elements in the gap are already dealt with.
+static bool array_close_gap(Array *array, size_t start, size_t end) {
+	if (array->deque && start == 0) {
+		// Step head forward instead of moving everything
+		array->head = (array->head + end) % array->capacity;
+	} else if (end < array->size) {
+		if (!array_linearize(array)) {
+			return false;
+		}
+		array_stats_moved(array, (array->size - end) * array->element_size);
+		memmove(_array_unsafe_at(array, start), _array_unsafe_at(array, end),
+				(array->size - end) * array->element_size);
+		array_index_shift(array, end, array->size,
+				(ptrdiff_t)start - (ptrdiff_t)end);
+	}
+	array->size -= end - start;
+	array_scale_capacity(array);
+	return true;
+}
+
+void array_remove_range(Array *array, ptrdiff_t start, ptrdiff_t end) {
+	// Removes [start, end), both support negative indexing
+	start = start < 0 ? start + array->size : start;
+	end = end < 0 ? end + array->size : end;
+	if (start < 0 || (size_t)end > array->size || start >= end ||
+			!array_own(array)) {
+		return;
+	}
+
+	array_stats_call(array, ARRAY_OP_REMOVE);
+	// Before element_free, a hash might look at what elements point to
+	array_index_drop(array, start, end);
+	if (array->element_free) {
+		for (ptrdiff_t i = start; i < end; i++) {
+			array->element_free(_array_unsafe_at(array, i));
+		}
+	}
+	array_close_gap(array, start, end);
+}
+
+// Moves [start, end) into out, which takes over ownership so element_free
+// isn't called. Returns how many moved.
+static size_t array_take(Array *array, size_t start, size_t end, void *out) {
+	if (start >= end || end > array->size || !array_own(array)) {
+		return 0;
+	}
+	bool moves_tail = !(array->deque && start == 0) && end < array->size;
+	if (moves_tail && !array_linearize(array)) {
+		return 0;
+	}
+
+	array_index_drop(array, start, end);
+	array_copy_out(array, start, out, end - start);
+	array_close_gap(array, start, end);
+	return end - start;
+}
+
+size_t array_drain(Array *array, ptrdiff_t start, ptrdiff_t end, void *out) {
+	start = start < 0 ? start + array->size : start;
+	end = end < 0 ? end + array->size : end;
+	if (start < 0 || end < 0) {
+		return 0;
+	}
+	array_stats_call(array, ARRAY_OP_REMOVE);
+	return array_take(array, start, end, out);
+}
+
+size_t array_pop_front_into(Array *array, void *out, size_t n) {
+	n = n < array->size ? n : array->size;
+	array_stats_call(array, ARRAY_OP_POP);
+	return array_take(array, 0, n, out);
+}
+
+size_t array_pop_back_into(Array *array, void *out, size_t n) {
+	n = n < array->size ? n : array->size;
+	array_stats_call(array, ARRAY_OP_POP);
+	return array_take(array, array->size - n, array->size, out);
+}
+
+void array_remove(Array *array, void *element) {
+	array_remove_custom(array, NULL, element);
+}
+
+void array_remove_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	ptrdiff_t index = array_find_custom(array, compare, element);
+	if (index < 0) {
+		return;
+	}
+	array_remove_at(array, index);
+}
+
+// What array_compact drops
+typedef enum ArrayDrop {
+	ARRAY_DROP_UNLESS,
+	ARRAY_DROP_IF,
+	ARRAY_DROP_EQUAL,
+	ARRAY_DROP_ADJACENT,
+} ArrayDrop;
+
+static inline bool array_equal(int (*compare)(void *, void *), void *a,
+		void *b, size_t element_size) {
+	return compare ? compare(a, b) == 0 : memcmp(a, b, element_size) == 0;
+}
+
+// Drops elements from start on in one pass, survivors slide down over the
+// gaps as they're found. element_free runs once per dropped element and
+// capacity is only looked at once, at the end.
+static void array_compact(Array *array, size_t start, ArrayDrop drop,
+		bool (*predicate)(void *), int (*compare)(void *, void *),
+		void *element) {
+	if (!array_own(array) || !array_linearize(array)) {
+		return;
+	}
+
+	array_stats_call(array, ARRAY_OP_REMOVE);
+	size_t element_size = array->element_size;
+	char *data = array->data;
+	char *parked = NULL;
+	if (drop == ARRAY_DROP_EQUAL) {
+		// It might point into the array, copy it out where compacting can't
+		// overwrite it
+		parked = malloc(element_size);
+		if (!parked) {
+			printf("malloc failed\n");
+			return;
+		}
+		memcpy(parked, element, element_size);
+		element = parked;
+	}
+
+	size_t kept = start;
+	for (size_t i = start; i < array->size; i++) {
+		char *current = data + i * element_size;
+		bool dropped = false;
+		switch (drop) {
+			case ARRAY_DROP_UNLESS:
+				dropped = !predicate(current);
+				break;
+			case ARRAY_DROP_IF:
+				dropped = predicate(current);
+				break;
+			case ARRAY_DROP_EQUAL:
+				dropped = array_equal(compare, current, element, element_size);
+				break;
+			case ARRAY_DROP_ADJACENT:
+				dropped = kept && array_equal(compare, current,
+						data + (kept - 1) * element_size, element_size);
+				break;
+		}
+
+		if (dropped) {
+			if (array->element_free) {
+				array->element_free(current);
+			}
+			continue;
+		}
+		if (kept != i) {
+			memcpy(data + kept * element_size, current, element_size);
+		}
+		kept++;
+	}
+	array_stats_moved(array, kept * element_size);
+	free(parked);
+
+	if (kept == array->size) {
+		return;
+	}
+	array->size = kept;
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+	array_scale_capacity(array);
+}
+
+void array_remove_all(Array *array, void *element) {
+	array_remove_all_custom(array, NULL, element);
+}
+
+void array_remove_all_custom(Array *array, int (*compare)(void *, void *),
+		void *element) {
+	// Everything before the first match stays put, and finding it can use
+	// the index, a binary search or the vectorized scan
+	ptrdiff_t first = array_find_custom(array, compare, element);
+	if (first < 0) {
+		return;
+	}
+	array_compact(array, first, ARRAY_DROP_EQUAL, NULL, compare, element);
+}
+
+void array_remove_if(Array *array, bool (*remove)(void *)) {
+	array_compact(array, 0, ARRAY_DROP_IF, remove, NULL, NULL);
+}
+
+void array_dedup_adjacent(Array *array) {
+	array_dedup_adjacent_custom(array, NULL);
+}
+
+void array_dedup_adjacent_custom(Array *array, int (*compare)(void *, void *)) {
+	array_compact(array, 0, ARRAY_DROP_ADJACENT, NULL, compare, NULL);
+}
+
+void *_array_front(Array *array) {
+	return _array_at(array, 0);
+}
+
+void *_array_back(Array *array) {
+	return _array_at(array, -1);
+}
+
+void array_push_front(Array *array, void *element) {
+	array_insert_range(array, 0, element, 1);
+}
+
+void array_push_back(Array *array, void *element) {
+	if (!array_own(array)) {
+		return;
+	}
+	array_stats_call(array, ARRAY_OP_PUSH_BACK);
+	array_stats_moved(array, array->element_size);
+	array->order = NULL;
+	array->size++;
+	array_scale_capacity(array);
+	memcpy(_array_back(array), element, array->element_size);
+	array_index_add(array, array->size - 1, array->size);
+}
+
+void array_push_back_n(Array *array, void *elements, size_t n) {
+	array_insert_range(array, array->size, elements, n);
+}
+
+void array_append_array(Array *array, Array *other) {
+	if (array->element_size != other->element_size) {
+		printf("element_size mismatch\n");
+		return;
+	}
+
+	if (!array_own(array)) {
+		return;
+	}
+	array->order = NULL;
+
+	// Read other's data after growing, it moves when other == array
+	size_t old_size = array->size;
+	size_t n = other->size;
+	array->size += n;
+	array_scale_capacity(array);
+	array_copy_in(array, old_size, array_contiguous(other), n);
+	array_index_add(array, old_size, array->size);
+}
+
+void *_array_pop_front(Array *array, bool fast) {
+	if (array->size <= 0 || !array_own(array)) {
+		// TODO: Throw error
+		return NULL;
+	}
+	array_stats_call(array, ARRAY_OP_POP);
+	array_index_drop(array, 0, 1);
+	if (array->deque) {
+		// Park the element in the slot past the back and step head forward,
+		// that slot is the one past size once it shrinks by one
+		memmove(_array_unsafe_at(array, array->size), _array_at(array, 0),
+				array->element_size);
+		array->head = (array->head + 1) % array->capacity;
+		array->size--;
+		array_scale_capacity(array);
+		return _array_unsafe_at(array, array->size);
+	}
+	if (array->size == 1) {
+		array->size--;
+		return _array_unsafe_at(array, 0);
+	}
+
+	memcpy(_array_unsafe_at(array, array->size), _array_at(array, 0),
+			array->element_size);
+
+	array->size--;
+
+	// if fast, copy just the last to the front, else everything moves left
+	size_t from = fast ? array->size : 1;
+	size_t n = fast ? 1 : array->size;
+
+	array_stats_moved(array, (n + 2) * array->element_size);
+	memmove(_array_at(array, 0), _array_unsafe_at(array, from),
+			n * array->element_size);
+	memcpy(_array_unsafe_at(array, array->size),
+			_array_unsafe_at(array, array->size + 1), array->element_size);
+	array_index_shift(array, from, from + n, -(ptrdiff_t)from);
+
+	array_scale_capacity(array);
+
+	return _array_unsafe_at(array, array->size);
+}
+
+void *_array_pop_back(Array *array) {
+	if (array->size <= 0 || !array_own(array)) {
+		// TODO: Throw error
+		return NULL;
+	}
+
+	array_stats_call(array, ARRAY_OP_POP);
+	array_index_drop(array, array->size - 1, array->size);
+	array->size--;
+	array_scale_capacity(array);
+
+	return _array_unsafe_at(array, array->size);
+}
+
+void *_array_pop_at(Array *array, ptrdiff_t index) {
+	void *ptr = _array_at(array, index);
+	if (ptr == _array_front(array)) {
+		return _array_pop_front(array, false);
+	}
+	if (ptr == _array_back(array)) {
+		return _array_pop_back(array);
+	}
+
+	index = index < 0 ? array->size + index : index;
+	if (!array_own(array) || !array_linearize(array)) {
+		return NULL;
+	}
+	ptr = _array_at(array, index);
+	array_stats_call(array, ARRAY_OP_POP);
+	array_stats_moved(array, (array->size - index + 1) * array->element_size);
+	array_index_drop(array, index, index + 1);
+
+	memmove(_array_unsafe_at(array, array->size), ptr, array->element_size);
+	memmove(ptr, _array_unsafe_at(array, index + 1),
+			(array->size - index) * array->element_size);
+	array_index_shift(array, index + 1, array->size, -1);
+
+	array->size--;
+	array_scale_capacity(array);
+
+	return _array_unsafe_at(array, array->size);
+}
+
+bool array_all(Array *array, bool (*predicate)(void *)) {
+	for (size_t i = 0; i < array->size; i++) {
+		void *element = _array_at(array, i);
+		if (!predicate(element)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool array_any(Array *array, bool (*predicate)(void *)) {
+	for (size_t i = 0; i < array->size; i++) {
+		void *element = _array_at(array, i);
+		if (predicate(element)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// See array_map_par for the parallel one
+Array *array_map(Array *array, void (*map)(void *, void *)) {
+	Array *mapped_array = _array_new_with_allocator(array->element_size,
+			&array->allocator);
+	if (!mapped_array) {
+		return NULL;
+	}
+	array_transform_into(array, mapped_array, map);
+	return mapped_array;
+}
+
+Array *array_filter(Array *array, bool (*filter)(void *)) {
+	Array *filtered_array = _array_new_with_allocator(array->element_size,
+			&array->allocator);
+	for (size_t i = 0; i < array->size; i++) {
+		void *element = _array_at(array, i);
+		if (filter(element)) {
+			array_push_back(filtered_array, element);
+		}
+	}
+	return filtered_array;
+}
+
+void array_reduce(Array *array, void (*reduce)(void *, void *),
+		void *accumulator) {
+	for (size_t i = 0; i < array->size; i++) {
+		void *element = _array_at(array, i);
+		reduce(element, accumulator);
+	}
+}
+
+void array_retain(Array *array, bool (*retain)(void *)) {
+	array_compact(array, 0, ARRAY_DROP_UNLESS, retain, NULL, NULL);
+}
+
+void array_transform(Array *array, void (*transform)(void *, void *)) {
+	if (!array_own(array)) {
+		return;
+	}
+	array->order = NULL;
+	// Results go through a temp, so transform never sees its input and
+	// output alias
+	size_t element_size = array->element_size;
+	void *result = malloc(element_size);
+	if (!result) {
+		printf("malloc failed\n");
+		return;
+	}
+	for (size_t i = 0; i < array->size; i++) {
+		void *element = _array_unsafe_at(array, i);
+		transform(element, result);
+		memcpy(element, result, element_size);
+	}
+	free(result);
+	array_stats_moved(array, array->size * element_size);
+	if (array->index) {
+		array_index_rebuild(array);
+	}
+}
+
+void array_transform_into(Array *array, Array *out,
+		void (*transform)(void *, void *)) {
+	if (out == array) {
+		array_transform(array, transform);
+		return;
+	}
+
+	if (!array_own(out)) {
+		return;
+	}
+	out->order = NULL;
+
+	// Whatever out held is overwritten
+	if (out->element_free) {
+		for (size_t i = 0; i < out->size; i++) {
+			out->element_free(_array_unsafe_at(out, i));
+		}
+	}
+	out->size = array->size;
+	array_scale_capacity(out);
+	if (!array_linearize(out)) {
+		return;
+	}
+
+	size_t element_size = out->element_size;
+	char *data = out->data;
+	for (size_t i = 0; i < array->size; i++) {
+		transform(_array_unsafe_at(array, i), data + i * element_size);
+	}
+	if (out->index) {
+		array_index_rebuild(out);
+	}
+}
+
+static size_t array_parallel_threshold = ARRAY_PARALLEL_THRESHOLD;
+
+void array_set_parallel_threshold(size_t threshold) {
+	array_parallel_threshold = threshold;
+}
+
+#ifndef ARRAY_NO_THREADS
+// One job runs at a time, split into chunks that the caller and the workers
+// grab off next until they run out
+typedef struct ArrayJob {
+	void (*run)(void *context, size_t chunk);
+	void *context;
+	size_t chunks;
+	atomic_size_t next;
+	// Guarded by the pool lock
+	size_t finished;
+	size_t workers;
+} ArrayJob;
+
+static struct {
+	pthread_mutex_t submit;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pthread_t *threads;
+	size_t thread_count;
+	size_t requested_threads;
+	ArrayJob *job;
+	size_t generation;
+	bool stop;
+} array_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Set while this thread runs chunks, so a _par call from inside a callback
+// runs inline instead of waiting on the job it's part of
+static _Thread_local bool array_in_job;
+
+static void array_job_work(ArrayJob *job) {
+	size_t done = 0;
+	array_in_job = true;
+	size_t chunk = atomic_fetch_add(&job->next, 1);
+	for (; chunk < job->chunks; chunk = atomic_fetch_add(&job->next, 1)) {
+		job->run(job->context, chunk);
+		done++;
+	}
+	array_in_job = false;
+
+	if (done) {
+		pthread_mutex_lock(&array_pool.lock);
+		job->finished += done;
+		if (job->finished == job->chunks) {
+			pthread_cond_broadcast(&array_pool.done);
+		}
+		pthread_mutex_unlock(&array_pool.lock);
+	}
+}
+
+static void *array_worker(void *arg) {
+	(void)arg;
+	size_t generation = 0;
+
+	pthread_mutex_lock(&array_pool.lock);
+	while (true) {
+		while (!array_pool.stop &&
+				(!array_pool.job || array_pool.generation == generation)) {
+			pthread_cond_wait(&array_pool.wake, &array_pool.lock);
+		}
+		if (array_pool.stop) {
+			break;
+		}
+
+		// The job lives on the submitter's stack, it waits for workers == 0
+		ArrayJob *job = array_pool.job;
+		generation = array_pool.generation;
+		job->workers++;
+		pthread_mutex_unlock(&array_pool.lock);
+
+		array_job_work(job);
+
+		pthread_mutex_lock(&array_pool.lock);
+		job->workers--;
+		if (job->workers == 0) {
+			pthread_cond_broadcast(&array_pool.done);
+		}
+	}
+	pthread_mutex_unlock(&array_pool.lock);
+	return NULL;
+}
+
+// Called with submit held
+static void array_pool_start(void) {
+	if (array_pool.threads || array_pool.thread_count) {
+		return;
+	}
+
+	size_t threads = array_pool.requested_threads;
+	if (!threads) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (size_t)cores : 1;
+	}
+
+	// The submitting thread works too
+	array_pool.thread_count = threads - 1;
+	if (!array_pool.thread_count) {
+		return;
+	}
+
+	array_pool.threads = malloc(array_pool.thread_count * sizeof(pthread_t));
+	if (!array_pool.threads) {
+		printf("malloc failed\n");
+		array_pool.thread_count = 0;
+		return;
+	}
+	for (size_t i = 0; i < array_pool.thread_count; i++) {
+		if (pthread_create(&array_pool.threads[i], NULL, array_worker, NULL)) {
+			printf("pthread_create failed\n");
+			array_pool.thread_count = i;
+			break;
+		}
+	}
+}
+
+// Called with submit held
+static void array_pool_stop(void) {
+	pthread_mutex_lock(&array_pool.lock);
+	array_pool.stop = true;
+	pthread_cond_broadcast(&array_pool.wake);
+	pthread_mutex_unlock(&array_pool.lock);
+
+	for (size_t i = 0; i < array_pool.thread_count && array_pool.threads; i++) {
+		pthread_join(array_pool.threads[i], NULL);
+	}
+	free(array_pool.threads);
+
+	array_pool.threads = NULL;
+	array_pool.thread_count = 0;
+	array_pool.stop = false;
+}
+
+void array_set_parallel_threads(size_t threads) {
+	pthread_mutex_lock(&array_pool.submit);
+	array_pool_stop();
+	array_pool.requested_threads = threads;
+	pthread_mutex_unlock(&array_pool.submit);
+}
+
+void array_parallel_shutdown(void) {
+	pthread_mutex_lock(&array_pool.submit);
+	array_pool_stop();
+	pthread_mutex_unlock(&array_pool.submit);
+}
+
+static size_t array_parallel_workers(void) {
+	if (array_in_job) {
+		return 1;
+	}
+	pthread_mutex_lock(&array_pool.submit);
+	array_pool_start();
+	size_t threads = array_pool.thread_count + 1;
+	pthread_mutex_unlock(&array_pool.submit);
+	return threads;
+}
+
+static void array_parallel_run(void (*run)(void *, size_t), void *context,
+		size_t chunks) {
+	if (array_in_job) {
+		for (size_t chunk = 0; chunk < chunks; chunk++) {
+			run(context, chunk);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&array_pool.submit);
+	array_pool_start();
+
+	ArrayJob job = { run, context, chunks, 0, 0, 0 };
+	pthread_mutex_lock(&array_pool.lock);
+	array_pool.job = &job;
+	array_pool.generation++;
+	pthread_cond_broadcast(&array_pool.wake);
+	pthread_mutex_unlock(&array_pool.lock);
+
+	array_job_work(&job);
+
+	pthread_mutex_lock(&array_pool.lock);
+	while (job.finished < job.chunks || job.workers > 0) {
+		pthread_cond_wait(&array_pool.done, &array_pool.lock);
+	}
+	array_pool.job = NULL;
+	pthread_mutex_unlock(&array_pool.lock);
+
+	pthread_mutex_unlock(&array_pool.submit);
+}
+#else
+void array_set_parallel_threads(size_t threads) {
+	(void)threads;
+}
+
+void array_parallel_shutdown(void) {
+}
+
+static size_t array_parallel_workers(void) {
+	return 1;
+}
+
+static void array_parallel_run(void (*run)(void *, size_t), void *context,
+		size_t chunks) {
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		run(context, chunk);
+	}
+}
+#endif
+
+// A few chunks per thread evens out uneven work, but not so many that
+// chunks get smaller than ARRAY_PARALLEL_MIN_CHUNK elements
+static size_t array_parallel_chunks(size_t size) {
+	size_t chunks = array_parallel_workers() * 4;
+	size_t max_chunks = (size + ARRAY_PARALLEL_MIN_CHUNK - 1) /
+			ARRAY_PARALLEL_MIN_CHUNK;
+	chunks = chunks < max_chunks ? chunks : max_chunks;
+	return chunks ? chunks : 1;
+}
+
+typedef struct ArrayParallel {
+	char *data;
+	char *out;
+	size_t size;
+	size_t element_size;
+	size_t chunks;
+	void (*map)(void *, void *);
+	bool (*filter)(void *);
+	void (*reduce)(void *, void *);
+	bool *keep;
+	size_t *offsets;
+	char *accumulators;
+	size_t accumulator_size;
+	// One per chunk for iterator pipelines
+	struct ArrayIterPass *passes;
+} ArrayParallel;
+
+static void array_parallel_range(ArrayParallel *parallel, size_t chunk,
+		size_t *start, size_t *end) {
+	*start = parallel->size * chunk / parallel->chunks;
+	*end = parallel->size * (chunk + 1) / parallel->chunks;
+}
+
+static void array_map_chunk(void *context, size_t chunk) {
+	ArrayParallel *parallel = context;
+	size_t start, end;
+	array_parallel_range(parallel, chunk, &start, &end);
+
+	// Straight into the preallocated output, no scratch element
+	for (size_t i = start; i < end; i++) {
+		parallel->map(parallel->data + i * parallel->element_size,
+				parallel->out + i * parallel->element_size);
+	}
+}
+
+Array *array_map_par(Array *array, void (*map)(void *, void *)) {
+	if (array->size < array_parallel_threshold) {
+		return array_map(array, map);
+	}
+
+	Array *mapped_array = _array_new_with_allocator(array->element_size,
+			&array->allocator);
+	if (!mapped_array) {
+		return NULL;
+	}
+	array_resize(mapped_array, array->size);
+
+	ArrayParallel parallel = { .data = array_contiguous(array),
+		.out = mapped_array->data,
+		.size = array->size,
+		.element_size = array->element_size,
+		.chunks = array_parallel_chunks(array->size),
+		.map = map };
+	array_parallel_run(array_map_chunk, &parallel, parallel.chunks);
+
+	return mapped_array;
+}
+
+static void array_filter_count_chunk(void *context, size_t chunk) {
+	ArrayParallel *parallel = context;
+	size_t start, end;
+	array_parallel_range(parallel, chunk, &start, &end);
+
+	size_t count = 0;
+	for (size_t i = start; i < end; i++) {
+		parallel->keep[i] = parallel->filter(parallel->data + i * parallel->element_size);
+		count += parallel->keep[i];
+	}
+	parallel->offsets[chunk] = count;
+}
+
+static void array_filter_copy_chunk(void *context, size_t chunk) {
+	ArrayParallel *parallel = context;
+	size_t start, end;
+	array_parallel_range(parallel, chunk, &start, &end);
+
+	char *out = parallel->out + parallel->offsets[chunk] * parallel->element_size;
+	for (size_t i = start; i < end; i++) {
+		if (parallel->keep[i]) {
+			memcpy(out, parallel->data + i * parallel->element_size,
+					parallel->element_size);
+			out += parallel->element_size;
+		}
+	}
+}
+
+Array *array_filter_par(Array *array, bool (*filter)(void *)) {
+	if (array->size < array_parallel_threshold) {
+		return array_filter(array, filter);
+	}
+
+	ArrayParallel parallel = { .data = array_contiguous(array),
+		.size = array->size,
+		.element_size = array->element_size,
+		.chunks = array_parallel_chunks(array->size),
+		.filter = filter };
+	parallel.keep = malloc(array->size * sizeof(bool));
+	parallel.offsets = malloc(parallel.chunks * sizeof(size_t));
+	if (!parallel.keep || !parallel.offsets) {
+		printf("malloc failed\n");
+		free(parallel.keep);
+		free(parallel.offsets);
+		return NULL;
+	}
+
+	// Count what each chunk keeps, then a prefix sum tells every chunk
+	// where its survivors go so the output stays in order
+	array_parallel_run(array_filter_count_chunk, &parallel, parallel.chunks);
+
+	size_t total = 0;
+	for (size_t chunk = 0; chunk < parallel.chunks; chunk++) {
+		size_t count = parallel.offsets[chunk];
+		parallel.offsets[chunk] = total;
+		total += count;
+	}
+
+	Array *filtered_array = _array_new_with_allocator(array->element_size,
+			&array->allocator);
+	if (filtered_array) {
+		array_resize(filtered_array, total);
+		parallel.out = filtered_array->data;
+		array_parallel_run(array_filter_copy_chunk, &parallel, parallel.chunks);
+	}
+
+	free(parallel.keep);
+	free(parallel.offsets);
+	return filtered_array;
+}
+
+static void array_reduce_chunk(void *context, size_t chunk) {
+	ArrayParallel *parallel = context;
+	size_t start, end;
+	array_parallel_range(parallel, chunk, &start, &end);
+
+	void *accumulator = parallel->accumulators + chunk * parallel->accumulator_size;
+	for (size_t i = start; i < end; i++) {
+		parallel->reduce(parallel->data + i * parallel->element_size, accumulator);
+	}
+}
+
+void _array_reduce_par(Array *array, void (*reduce)(void *, void *),
+		void (*combine)(void *, void *), void *accumulator, void *identity,
+		size_t accumulator_size) {
+	if (array->size < array_parallel_threshold) {
+		array_reduce(array, reduce, accumulator);
+		return;
+	}
+
+	ArrayParallel parallel = { .data = array_contiguous(array),
+		.size = array->size,
+		.element_size = array->element_size,
+		.chunks = array_parallel_chunks(array->size),
+		.reduce = reduce,
+		.accumulator_size = accumulator_size };
+	parallel.accumulators = malloc(parallel.chunks * accumulator_size);
+	if (!parallel.accumulators) {
+		printf("malloc failed\n");
+		return;
+	}
+
+	// Every chunk starts from identity, partials are combined in order
+	for (size_t chunk = 0; chunk < parallel.chunks; chunk++) {
+		memcpy(parallel.accumulators + chunk * accumulator_size, identity,
+				accumulator_size);
+	}
+	array_parallel_run(array_reduce_chunk, &parallel, parallel.chunks);
+	for (size_t chunk = 0; chunk < parallel.chunks; chunk++) {
+		combine(parallel.accumulators + chunk * accumulator_size, accumulator);
+	}
+
+	free(parallel.accumulators);
+}
+
+ArrayIter array_iter(Array *array) {
+	return (ArrayIter){ .array = array, .element_size = array->element_size };
+}
+
+static ArrayIter array_iter_add(ArrayIter iter, ArrayIterStage stage) {
+	if (!iter.array) {
+		return iter;
+	}
+	if (iter.stage_count == ARRAY_ITER_MAX_STAGES) {
+		printf("too many iterator stages\n");
+		iter.array = NULL;
+		return iter;
+	}
+	iter.stages[iter.stage_count++] = stage;
+	iter.element_size = stage.element_size;
+	return iter;
+}
+
+ArrayIter array_iter_map(ArrayIter iter, void (*map)(void *, void *)) {
+	return _array_iter_map_to(iter, map, iter.element_size);
+}
+
+ArrayIter _array_iter_map_to(ArrayIter iter, void (*map)(void *, void *),
+		size_t result_size) {
+	return array_iter_add(iter, (ArrayIterStage){ .kind = ARRAY_ITER_MAP,
+			.map = map, .element_size = result_size });
+}
+
+ArrayIter array_iter_filter(ArrayIter iter, bool (*filter)(void *)) {
+	return array_iter_add(iter, (ArrayIterStage){ .kind = ARRAY_ITER_FILTER,
+			.filter = filter, .element_size = iter.element_size });
+}
+
+ArrayIter array_iter_take(ArrayIter iter, size_t n) {
+	return array_iter_add(iter, (ArrayIterStage){ .kind = ARRAY_ITER_TAKE,
+			.take = n, .element_size = iter.element_size });
+}
+
+typedef enum ArrayIterSink {
+	ARRAY_ITER_REDUCE,
+	ARRAY_ITER_COLLECT,
+	ARRAY_ITER_COUNT,
+} ArrayIterSink;
+
+// One run over the source, or one chunk of it. Map stages write their
+// results one after another into scratch.
+typedef struct ArrayIterPass {
+	ArrayIter *iter;
+	ArrayIterSink sink;
+	void (*reduce)(void *, void *);
+	void *accumulator;
+	Array *out;
+	size_t count;
+	size_t taken[ARRAY_ITER_MAX_STAGES];
+	char *scratch;
+	_Alignas(max_align_t) char buffer[ARRAY_ITER_SCRATCH];
+} ArrayIterPass;
+
+static bool array_iter_pass_init(ArrayIterPass *pass, ArrayIter *iter,
+		ArrayIterSink sink) {
+	size_t scratch = 0;
+	for (size_t s = 0; s < iter->stage_count; s++) {
+		if (iter->stages[s].kind == ARRAY_ITER_MAP) {
+			scratch += array_align(iter->stages[s].element_size);
+		}
+	}
+
+	memset(pass->taken, 0, sizeof(pass->taken));
+	pass->iter = iter;
+	pass->sink = sink;
+	pass->count = 0;
+	pass->scratch = scratch <= ARRAY_ITER_SCRATCH ? pass->buffer : malloc(scratch);
+	if (!pass->scratch) {
+		printf("malloc failed\n");
+		return false;
+	}
+	return true;
+}
+
+static void array_iter_pass_free(ArrayIterPass *pass) {
+	if (pass->scratch != pass->buffer) {
+		free(pass->scratch);
+	}
+}
+
+// Runs source elements [start, end) through every stage and into the sink,
+// false once a take is full and nothing else can get through
+static bool array_iter_pass_run(ArrayIterPass *pass, char *data, size_t start,
+		size_t end) {
+	ArrayIter *iter = pass->iter;
+	size_t source_size = iter->array->element_size;
+
+	for (size_t i = start; i < end; i++) {
+		void *element = data + i * source_size;
+		char *out = pass->scratch;
+		bool full = false;
+		size_t s = 0;
+		for (; s < iter->stage_count; s++) {
+			ArrayIterStage *stage = &iter->stages[s];
+			if (stage->kind == ARRAY_ITER_MAP) {
+				stage->map(element, out);
+				element = out;
+				out += array_align(stage->element_size);
+			} else if (stage->kind == ARRAY_ITER_FILTER) {
+				if (!stage->filter(element)) {
+					break;
+				}
+			} else {
+				if (pass->taken[s] == stage->take) {
+					return false;
+				}
+				full |= ++pass->taken[s] == stage->take;
+			}
+		}
+
+		if (s == iter->stage_count) {
+			switch (pass->sink) {
+				case ARRAY_ITER_REDUCE:
+					pass->reduce(element, pass->accumulator);
+					break;
+				case ARRAY_ITER_COLLECT:
+					array_push_back(pass->out, element);
+					break;
+				case ARRAY_ITER_COUNT:
+					pass->count++;
+					break;
+			}
+		}
+		if (full) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void array_iter_run(ArrayIterPass *pass) {
+	Array *array = pass->iter->array;
+	array_iter_pass_run(pass, array_contiguous(array), 0, array->size);
+	array_iter_pass_free(pass);
+}
+
+void array_iter_reduce(ArrayIter iter, void (*reduce)(void *, void *),
+		void *accumulator) {
+	ArrayIterPass pass;
+	if (!iter.array || !array_iter_pass_init(&pass, &iter, ARRAY_ITER_REDUCE)) {
+		return;
+	}
+	pass.reduce = reduce;
+	pass.accumulator = accumulator;
+	array_iter_run(&pass);
+}
+
+static Array *array_iter_output(ArrayIter *iter) {
+	return _array_new_with_allocator(iter->element_size, &iter->array->allocator);
+}
+
+Array *array_iter_collect(ArrayIter iter) {
+	ArrayIterPass pass;
+	if (!iter.array || !array_iter_pass_init(&pass, &iter, ARRAY_ITER_COLLECT)) {
+		return NULL;
+	}
+	pass.out = array_iter_output(&iter);
+	if (!pass.out) {
+		array_iter_pass_free(&pass);
+		return NULL;
+	}
+	array_iter_run(&pass);
+	return pass.out;
+}
+
+size_t array_iter_count(ArrayIter iter) {
+	ArrayIterPass pass;
+	if (!iter.array || !array_iter_pass_init(&pass, &iter, ARRAY_ITER_COUNT)) {
+		return 0;
+	}
+	array_iter_run(&pass);
+	return pass.count;
+}
+
+// Takes need elements in order, so those pipelines stay on one thread
+static bool array_iter_parallel(ArrayIter *iter) {
+	if (iter->array->size < array_parallel_threshold) {
+		return false;
+	}
+	for (size_t s = 0; s < iter->stage_count; s++) {
+		if (iter->stages[s].kind == ARRAY_ITER_TAKE) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void array_iter_chunk(void *context, size_t chunk) {
+	ArrayParallel *parallel = context;
+	size_t start, end;
+	array_parallel_range(parallel, chunk, &start, &end);
+	array_iter_pass_run(&parallel->passes[chunk], parallel->data, start, end);
+}
+
+// Sets up a pass per chunk, the caller points them at their sinks
+static bool array_iter_parallel_init(ArrayParallel *parallel, ArrayIter *iter,
+		ArrayIterSink sink) {
+	*parallel = (ArrayParallel){ .data = array_contiguous(iter->array),
+		.size = iter->array->size,
+		.chunks = array_parallel_chunks(iter->array->size) };
+	parallel->passes = malloc(parallel->chunks * sizeof(ArrayIterPass));
+	if (!parallel->passes) {
+		printf("malloc failed\n");
+		parallel->chunks = 0;
+		return false;
+	}
+	for (size_t chunk = 0; chunk < parallel->chunks; chunk++) {
+		if (!array_iter_pass_init(&parallel->passes[chunk], iter, sink)) {
+			parallel->chunks = chunk;
+			return false;
+		}
+	}
+	return true;
+}
+
+static void array_iter_parallel_free(ArrayParallel *parallel) {
+	for (size_t chunk = 0; chunk < parallel->chunks; chunk++) {
+		array_iter_pass_free(&parallel->passes[chunk]);
+	}
+	free(parallel->passes);
+}
+
+void _array_iter_reduce_par(ArrayIter iter, void (*reduce)(void *, void *),
+		void (*combine)(void *, void *), void *accumulator, void *identity,
+		size_t accumulator_size) {
+	if (!iter.array) {
+		return;
+	}
+	if (!array_iter_parallel(&iter)) {
+		array_iter_reduce(iter, reduce, accumulator);
+		return;
+	}
+
+	ArrayParallel parallel;
+	if (!array_iter_parallel_init(&parallel, &iter, ARRAY_ITER_REDUCE)) {
+		array_iter_parallel_free(&parallel);
+		return;
+	}
+	parallel.accumulators = malloc(parallel.chunks * accumulator_size);
+	if (!parallel.accumulators) {
+		printf("malloc failed\n");
+		array_iter_parallel_free(&parallel);
+		return;
+	}
+
+	for (size_t chunk = 0; chunk < parallel.chunks; chunk++) {
+		void *partial = parallel.accumulators + chunk * accumulator_size;
+		memcpy(partial, identity, accumulator_size);
+		parallel.passes[chunk].reduce = reduce;
+		parallel.passes[chunk].accumulator = partial;
+	}
+	array_parallel_run(array_iter_chunk, &parallel, parallel.chunks);
+	for (size_t chunk = 0; chunk < parallel.chunks; chunk++) {
+		combine(parallel.accumulators + chunk * accumulator_size, accumulator);
+	}
+
+	free(parallel.accumulators);
+	array_iter_parallel_free(&parallel);
+}
+
+Array *array_iter_collect_par(ArrayIter iter) {
+	if (!iter.array) {
+		return NULL;
+	}
+	if (!array_iter_parallel(&iter)) {
+		return array_iter_collect(iter);
+	}
+
+	// Chunks collect on their own, then get appended in order
+	ArrayParallel parallel;
+	Array *collected = NULL;
+	if (array_iter_parallel_init(&parallel, &iter, ARRAY_ITER_COLLECT)) {
+		collected = array_iter_output(&iter);
+	}
+	size_t outputs = 0;
+	for (; collected && outputs < parallel.chunks; outputs++) {
+		parallel.passes[outputs].out = array_iter_output(&iter);
+		if (!parallel.passes[outputs].out) {
+			array_free(collected);
+			collected = NULL;
+		}
+	}
+
+	if (collected) {
+		array_parallel_run(array_iter_chunk, &parallel, parallel.chunks);
+		for (size_t chunk = 0; chunk < parallel.chunks; chunk++) {
+			array_append_array(collected, parallel.passes[chunk].out);
+		}
+	}
+
+	for (size_t chunk = 0; chunk < outputs; chunk++) {
+		array_free(parallel.passes[chunk].out);
+	}
+	array_iter_parallel_free(&parallel);
+	return collected;
+}
+
+ArrayView array_view(Array *array) {
+	return (ArrayView){ array_contiguous(array), array->size,
+		array->element_size, array->element_size };
+}
+
+// Python style, clamped into [0, size]
+static size_t array_view_clamp(ptrdiff_t index, size_t size) {
+	if (index < 0) {
+		index += size;
+		return index < 0 ? 0 : index;
+	}
+	return (size_t)index < size ? (size_t)index : size;
+}
+
+ArrayView array_view_slice(ArrayView view, ptrdiff_t start, ptrdiff_t end) {
+	size_t first = array_view_clamp(start, view.size);
+	size_t last = array_view_clamp(end, view.size);
+	view.data = (char *)view.data + first * view.stride;
+	view.size = first < last ? last - first : 0;
+	return view;
+}
+
+ArrayView array_slice(Array *array, ptrdiff_t start, ptrdiff_t end) {
+	return array_view_slice(array_view(array), start, end);
+}
+
+ArrayView array_view_step(ArrayView view, size_t step) {
+	if (step == 0) {
+		view.size = 0;
+		return view;
+	}
+	view.size = (view.size + step - 1) / step;
+	view.stride *= step;
+	return view;
+}
+
+size_t array_view_size(ArrayView view) {
+	return view.size;
+}
+
+void *_array_view_at(ArrayView view, ptrdiff_t index) {
+	if (index < 0) {
+		index += view.size;
+	}
+	if (index < 0 || (size_t)index >= view.size) {
+		return NULL;
+	}
+	return (char *)view.data + index * view.stride;
+}
+
+static bool array_view_contiguous(ArrayView *view) {
+	return view->stride == view->element_size;
+}
+
+// Finds or counts like array_find_custom, minus the index and bsearch
+// shortcuts that need the whole array
+static ptrdiff_t array_view_scan(ArrayView *view,
+		int (*compare)(void *, void *), void *element, size_t *count) {
+	if (!compare && array_view_contiguous(view)) {
+		size_t i = array_scan(view->data, view->size, element,
+				view->element_size, count);
+		return !count && i < view->size ? (ptrdiff_t)i : -1;
+	}
+
+	char *data = view->data;
+	for (size_t i = 0; i < view->size; i++, data += view->stride) {
+		int diff = compare ? compare(data, element)
+						   : memcmp(data, element, view->element_size);
+		if (diff != 0) {
+			continue;
+		}
+		if (!count) {
+			return i;
+		}
+		(*count)++;
+	}
+	return -1;
+}
+
+ptrdiff_t array_view_find(ArrayView view, void *element) {
+	return array_view_scan(&view, NULL, element, NULL);
+}
+
+ptrdiff_t array_view_find_custom(ArrayView view,
+		int (*compare)(void *, void *), void *element) {
+	return array_view_scan(&view, compare, element, NULL);
+}
+
+bool array_view_contains(ArrayView view, void *element) {
+	return array_view_scan(&view, NULL, element, NULL) != -1;
+}
+
+bool array_view_contains_custom(ArrayView view,
+		int (*compare)(void *, void *), void *element) {
+	return array_view_scan(&view, compare, element, NULL) != -1;
+}
+
+size_t array_view_count(ArrayView view, void *element) {
+	size_t count = 0;
+	array_view_scan(&view, NULL, element, &count);
+	return count;
+}
+
+size_t array_view_count_custom(ArrayView view,
+		int (*compare)(void *, void *), void *element) {
+	size_t count = 0;
+	array_view_scan(&view, compare, element, &count);
+	return count;
+}
+
+Array *array_view_map(ArrayView view, void (*map)(void *, void *)) {
+	Array *mapped_array = _array_new(view.element_size);
+	if (!mapped_array) {
+		return NULL;
+	}
+	array_resize(mapped_array, view.size);
+
+	char *data = view.data;
+	char *out = mapped_array->data;
+	for (size_t i = 0; i < view.size; i++) {
+		map(data + i * view.stride, out + i * view.element_size);
+	}
+	return mapped_array;
+}
+
+Array *array_view_filter(ArrayView view, bool (*filter)(void *)) {
+	Array *filtered_array = _array_new(view.element_size);
+	if (!filtered_array) {
+		return NULL;
+	}
+
+	char *data = view.data;
+	for (size_t i = 0; i < view.size; i++, data += view.stride) {
+		if (filter(data)) {
+			array_push_back(filtered_array, data);
+		}
+	}
+	return filtered_array;
+}
+
+void array_view_reduce(ArrayView view, void (*reduce)(void *, void *),
+		void *accumulator) {
+	char *data = view.data;
+	for (size_t i = 0; i < view.size; i++, data += view.stride) {
+		reduce(data, accumulator);
+	}
+}
+
+void array_view_print(ArrayView view,
+		void (*element_to_string)(char *, void *)) {
+	printf("ArrayView {size: %zu, stride: %zu, element_size: %zu, data: {",
+			view.size, view.stride, view.element_size);
+
+	if (!element_to_string) {
+		printf("%p to %p}}\n", view.data,
+				(char *)view.data + (view.size - 1) * view.stride);
+		return;
+	}
+
+	char buffer[ELEMENT_STRING_BUFFER_SIZE];
+	for (size_t i = 0; i < view.size; i++) {
+		element_to_string(buffer, (char *)view.data + i * view.stride);
+		printf("%s", buffer);
+		if (i + 1 < view.size) {
+			printf(", ");
+		}
+	}
+
+	printf("}}\n");
+}
+
+// Segment k holds ARRAY_SEGMENT_BASE << k elements, so the table never
+// runs out and segments never move once allocated. size_t so the shift
+// doesn't overflow int from segment 21 on.
+#define ARRAY_SEGMENT_BASE ((size_t)1024)
+#define ARRAY_SEGMENTS 48
+
+struct ArrayConcurrent {
+	size_t element_size;
+	// Pushers bump this, on its own cache line so readers of segments
+	// don't share it
+	_Alignas(64) atomic_size_t reserved;
+	// Everything below this is copied in, pushes move it up in order
+	_Alignas(64) atomic_size_t published;
+	_Alignas(64) _Atomic(char *) segments[ARRAY_SEGMENTS];
+};
+
+static size_t array_log2(size_t n) {
+#if defined(__GNUC__)
+	return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(n);
+#else
+	size_t log = 0;
+	while (n >>= 1) {
+		log++;
+	}
+	return log;
+#endif
+}
+
+// Allocates segment, NULL if it's too big to ever allocate or malloc fails
+static char *array_segment_alloc(size_t segment, size_t element_size) {
+	size_t length = ARRAY_SEGMENT_BASE << segment;
+	char *data = NULL;
+	if (!element_size || length <= PTRDIFF_MAX / element_size) {
+		data = malloc(length * element_size);
+	}
+	if (!data) {
+		printf("malloc failed\n");
+	}
+	return data;
+}
+
+// Which segment index is in, and where in it
+static size_t array_segment_locate(size_t index, size_t *offset) {
+	size_t segment = array_log2(index / ARRAY_SEGMENT_BASE + 1);
+	*offset = index - ARRAY_SEGMENT_BASE * (((size_t)1 << segment) - 1);
+	return segment;
+}
+
+ArrayConcurrent *_array_concurrent_new(size_t type_size) {
+	ArrayConcurrent *array = malloc(sizeof(ArrayConcurrent));
+	if (!array) {
+		printf("malloc failed\n");
+		return NULL;
+	}
+	array->element_size = type_size;
+	atomic_init(&array->reserved, 0);
+	atomic_init(&array->published, 0);
+	for (size_t i = 0; i < ARRAY_SEGMENTS; i++) {
+		atomic_init(&array->segments[i], NULL);
+	}
+	return array;
+}
+
+void array_concurrent_free(ArrayConcurrent *array) {
+	if (!array) {
+		return;
+	}
+	for (size_t i = 0; i < ARRAY_SEGMENTS; i++) {
+		free(atomic_load(&array->segments[i]));
+	}
+	free(array);
+}
+
+// Whoever gets there first allocates the segment, anyone racing them frees
+// theirs and uses the winner's
+static char *array_concurrent_segment_data(ArrayConcurrent *array,
+		size_t segment) {
+	char *data = atomic_load_explicit(&array->segments[segment],
+			memory_order_acquire);
+	if (data) {
+		return data;
+	}
+
+	char *allocated = array_segment_alloc(segment, array->element_size);
+	if (!allocated) {
+		return NULL;
+	}
+	if (atomic_compare_exchange_strong_explicit(&array->segments[segment],
+				&data, allocated, memory_order_acq_rel,
+				memory_order_acquire)) {
+		return allocated;
+	}
+	free(allocated);
+	return data;
+}
+
+// Makes sure every segment slots first to first + n land in is allocated
+static bool array_concurrent_segments(ArrayConcurrent *array, size_t first,
+		size_t n) {
+	size_t offset;
+	size_t last = array_segment_locate(first + n - 1, &offset);
+	for (size_t segment = array_segment_locate(first, &offset);
+			segment <= last; segment++) {
+		if (!array_concurrent_segment_data(array, segment)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void array_concurrent_wait(unsigned spins) {
+#if defined(__unix__) || defined(__APPLE__)
+	if (spins >= 64) {
+		sched_yield();
+	}
+#else
+	(void)spins;
+#endif
+}
+
+size_t array_concurrent_push_n(ArrayConcurrent *array, void *elements,
+		size_t n) {
+	size_t element_size = array->element_size;
+
+	// Segments come before the reservation, so a failed push leaves
+	// nothing reserved and there are never holes to skip
+	size_t first = atomic_load_explicit(&array->reserved, memory_order_relaxed);
+	do {
+		if (n && (n > SIZE_MAX - first ||
+						!array_concurrent_segments(array, first, n))) {
+			return SIZE_MAX;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&array->reserved, &first,
+			first + n, memory_order_relaxed, memory_order_relaxed));
+
+	// The slots are ours, copy them in a segment at a time
+	size_t done = 0;
+	while (done < n) {
+		size_t offset;
+		size_t segment = array_segment_locate(first + done, &offset);
+		char *data = atomic_load_explicit(&array->segments[segment],
+				memory_order_acquire);
+
+		size_t room = (ARRAY_SEGMENT_BASE << segment) - offset;
+		size_t count = n - done < room ? n - done : room;
+		memcpy(data + offset * element_size,
+				(char *)elements + done * element_size, count * element_size);
+		done += count;
+	}
+
+	// Publish after every earlier push, so published never covers a slot
+	// still being copied. Earlier pushes have their segments already, they
+	// can't fail and are only ever a memcpy away.
+	for (unsigned spins = 0; atomic_load_explicit(&array->published,
+			memory_order_acquire) != first; spins++) {
+		array_concurrent_wait(spins);
+	}
+	atomic_store_explicit(&array->published, first + n, memory_order_release);
+	return first;
+}
+
+size_t array_concurrent_push(ArrayConcurrent *array, void *element) {
+	return array_concurrent_push_n(array, element, 1);
+}
+
+size_t array_concurrent_size(ArrayConcurrent *array) {
+	return atomic_load_explicit(&array->published, memory_order_acquire);
+}
+
+void *_array_concurrent_at(ArrayConcurrent *array, size_t index) {
+	if (index >= array_concurrent_size(array)) {
+		return NULL;
+	}
+
+	size_t offset;
+	size_t segment = array_segment_locate(index, &offset);
+	char *data = atomic_load_explicit(&array->segments[segment],
+			memory_order_relaxed);
+	return data + offset * array->element_size;
+}
+
+Array *array_concurrent_collect(ArrayConcurrent *array) {
+	size_t size = array_concurrent_size(array);
+	Array *collected = array_new_sized(array->element_size, size);
+	if (!collected) {
+		return NULL;
+	}
+
+	for (size_t segment = 0; array_size(collected) < size; segment++) {
+		size_t count = ARRAY_SEGMENT_BASE << segment;
+		size_t left = size - array_size(collected);
+		array_push_back_n(collected, atomic_load_explicit(
+				&array->segments[segment], memory_order_relaxed),
+				count < left ? count : left);
+	}
+	return collected;
+}
+
+struct ArraySegmented {
+	size_t element_size;
+	size_t size;
+	// Segments below this are allocated
+	size_t segment_count;
+	char *segments[ARRAY_SEGMENTS];
+};
+
+ArraySegmented *_array_segmented_new(size_t type_size) {
+	ArraySegmented *array = calloc(1, sizeof(ArraySegmented));
+	if (!array) {
+		printf("malloc failed\n");
+		return NULL;
+	}
+	array->element_size = type_size;
+	return array;
+}
+
+void array_segmented_free(ArraySegmented *array) {
+	if (!array) {
+		return;
+	}
+	for (size_t i = 0; i < array->segment_count; i++) {
+		free(array->segments[i]);
 	}
+	free(array);
 }
 
-void array_resize(Array *array, size_t new_size) {
-	size_t old_size = array->size;
-	array->size = new_size;
+size_t array_segmented_size(ArraySegmented *array) {
+	return array->size;
+}
 
-	if (array->element_free) {
-		for (size_t i = array->size; i < old_size; i++) {
-			array->element_free(_array_at(array, i));
+size_t array_segmented_capacity(ArraySegmented *array) {
+	return ARRAY_SEGMENT_BASE * (((size_t)1 << array->segment_count) - 1);
+}
+
+// Growing only ever adds segments, nothing already stored is touched
+bool array_segmented_reserve(ArraySegmented *array, size_t capacity) {
+	while (array_segmented_capacity(array) < capacity) {
+		if (array->segment_count == ARRAY_SEGMENTS) {
+			return false;
 		}
+		size_t segment = array->segment_count;
+		array->segments[segment] = array_segment_alloc(segment,
+				array->element_size);
+		if (!array->segments[segment]) {
+			return false;
+		}
+		array->segment_count++;
 	}
-
-	array_scale_capacity(array);
+	return true;
 }
 
-void array_scale_capacity(Array *array) {
-	size_t old_capacity = array->capacity;
+void *array_segmented_push_back(ArraySegmented *array, void *element) {
+	if (!array_segmented_push_back_n(array, element, 1)) {
+		return NULL;
+	}
+	return _array_segmented_at(array, -1);
+}
 
-	if (array->size < MIN_CAPACITY) {
-		array->capacity = MIN_CAPACITY;
-	} else if (array->size < array->capacity / 2 ||
-			array->size >= array->capacity) {
-		array->capacity = (size_t)exp2(floor(log2((double)array->size) + 1.0));
+bool array_segmented_push_back_n(ArraySegmented *array, void *elements,
+		size_t n) {
+	if (!array_segmented_reserve(array, array->size + n)) {
+		return false;
 	}
 
-	if (array->capacity != old_capacity) {
-		array->data = realloc(array->data, array->capacity * array->element_size);
-		if (!array->data) {
-			printf("realloc failed\n");
-			return;
-		}
-		for (size_t i = old_capacity; i < array->capacity; i++) {
-			memset(_array_unsafe_at(array, i), 0, array->element_size);
+	size_t element_size = array->element_size;
+	size_t done = 0;
+	while (done < n) {
+		size_t count;
+		char *data = array_segmented_chunk(array, array->size + done, &count);
+		if (count > n - done) {
+			count = n - done;
 		}
+		memcpy(data, (char *)elements + done * element_size,
+				count * element_size);
+		done += count;
 	}
+	array->size += n;
+	return true;
 }
 
-void array_shrink_to_fit(Array *array) {
-	array->capacity = array->size;
-	array->data = realloc(array->data, array->capacity * array->element_size);
-	if (!array->data) {
-		printf("realloc failed\n");
-		return;
+// Gives the slot whether or not it's in use, callers check against size
+void *array_segmented_chunk(ArraySegmented *array, size_t index,
+		size_t *count) {
+	if (index >= array_segmented_capacity(array)) {
+		*count = 0;
+		return NULL;
 	}
+	size_t offset;
+	size_t segment = array_segment_locate(index, &offset);
+	*count = (ARRAY_SEGMENT_BASE << segment) - offset;
+	return array->segments[segment] + offset * array->element_size;
 }
 
-void *_array_at(Array *array, ptrdiff_t index) {
-	// Supports Python style negative indexing
-	// TODO: throw error
+void *_array_segmented_at(ArraySegmented *array, ptrdiff_t index) {
 	if (index < 0) {
 		index += array->size;
 	}
-	if (index < 0 || index >= array->size) {
+	if (index < 0 || (size_t)index >= array->size) {
 		return NULL;
 	}
-	return (char *)array->data + index * array->element_size;
+	size_t count;
+	return array_segmented_chunk(array, index, &count);
 }
 
-void *_array_unsafe_at(Array *array, ptrdiff_t index) {
-	// Supports Python style negative indexing
-	if (index < 0) {
-		index += array->size;
+void array_segmented_set(ArraySegmented *array, ptrdiff_t index,
+		void *element) {
+	void *slot = _array_segmented_at(array, index);
+	if (slot) {
+		memcpy(slot, element, array->element_size);
 	}
-	return (char *)array->data + index * array->element_size;
 }
 
-void array_set(Array *array, ptrdiff_t index, void *element) {
-	memcpy(_array_at(array, index), element, array->element_size);
+void *_array_segmented_pop_back(ArraySegmented *array) {
+	void *element = _array_segmented_at(array, -1);
+	if (element) {
+		array->size--;
+	}
+	return element;
 }
 
-void *_array_get(Array *array, ptrdiff_t index) {
-	return _array_at(array, index);
+void array_segmented_clear(ArraySegmented *array) {
+	array->size = 0;
 }
 
-void array_insert_at(Array *array, ptrdiff_t index, void *element) {
-	void *target = _array_at(array, index);
-	if (!target) {
-		return;
+Array *array_segmented_collect(ArraySegmented *array) {
+	Array *collected = array_new_sized(array->element_size, array->size);
+	if (!collected) {
+		return NULL;
 	}
 
-	index = index < 0 ? index + array->size : index;
+	while (array_size(collected) < array->size) {
+		size_t count;
+		void *data = array_segmented_chunk(array, array_size(collected), &count);
+		size_t left = array->size - array_size(collected);
+		array_push_back_n(collected, data, count < left ? count : left);
+	}
+	return collected;
+}
 
-	array->size++;
-	array_scale_capacity(array);
-	memmove(_array_unsafe_at(array, index + 1), target,
-			(array->size - index) * array->element_size);
-	memcpy(target, element, array->element_size);
+// Each column is an Array of one field's values. They all see the same
+// pushes and removes, so their sizes and capacities move together.
+struct ArraySoA {
+	size_t record_size;
+	size_t field_count;
+	ArrayField *fields;
+	Array **columns;
+};
+
+ArraySoA *_array_soa_new(size_t record_size, const ArrayField *fields,
+		size_t field_count) {
+	for (size_t i = 0; i < field_count; i++) {
+		if (!fields[i].size || fields[i].offset + fields[i].size > record_size) {
+			printf("field %zu isn't inside the record\n", i);
+			return NULL;
+		}
+	}
+
+	ArraySoA *soa = malloc(sizeof(ArraySoA));
+	if (!soa) {
+		printf("malloc failed\n");
+		return NULL;
+	}
+	soa->record_size = record_size;
+	soa->field_count = field_count;
+	soa->fields = malloc(field_count * sizeof(ArrayField));
+	soa->columns = calloc(field_count, sizeof(Array *));
+	if (!soa->fields || !soa->columns) {
+		printf("malloc failed\n");
+		array_soa_free(soa);
+		return NULL;
+	}
+
+	memcpy(soa->fields, fields, field_count * sizeof(ArrayField));
+	for (size_t i = 0; i < field_count; i++) {
+		soa->columns[i] = _array_new(fields[i].size);
+		if (!soa->columns[i]) {
+			array_soa_free(soa);
+			return NULL;
+		}
+	}
+	return soa;
 }
 
-void array_remove_at(Array *array, ptrdiff_t index) {
-	void *target = _array_at(array, index);
-	if (!target) {
+void array_soa_free(ArraySoA *soa) {
+	if (!soa) {
 		return;
 	}
-	if (array->element_free) {
-		array->element_free(target);
+	for (size_t i = 0; soa->columns && i < soa->field_count; i++) {
+		array_free(soa->columns[i]);
 	}
+	free(soa->columns);
+	free(soa->fields);
+	free(soa);
+}
 
-	index = index < 0 ? array->size + index : index;
+size_t array_soa_size(ArraySoA *soa) {
+	return soa->field_count ? soa->columns[0]->size : 0;
+}
 
-	array->size--;
-	array_scale_capacity(array);
-	memmove(target, _array_unsafe_at(array, index + 1),
-			(array->size - index) * array->element_size);
+size_t array_soa_field_count(ArraySoA *soa) {
+	return soa->field_count;
 }
 
-void array_remove(Array *array, void *element) {
-	array_remove_custom(array, NULL, element);
+void array_soa_reserve(ArraySoA *soa, size_t capacity) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		array_reserve(soa->columns[i], capacity);
+	}
 }
 
-void array_remove_custom(Array *array, int (*compare)(void *, void *),
-		void *element) {
-	ptrdiff_t index = array_find_custom(array, compare, element);
-	if (index < 0) {
-		return;
+void array_soa_clear(ArraySoA *soa) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		array_clear(soa->columns[i]);
 	}
-	array_remove_at(array, index);
 }
 
-void *_array_front(Array *array) {
-	return _array_at(array, 0);
+void array_soa_push_back(ArraySoA *soa, void *record) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		array_push_back(soa->columns[i], (char *)record + soa->fields[i].offset);
+	}
 }
 
-void *_array_back(Array *array) {
-	return _array_at(array, -1);
+void array_soa_insert_at(ArraySoA *soa, ptrdiff_t index, void *record) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		array_insert_at(soa->columns[i], index,
+				(char *)record + soa->fields[i].offset);
+	}
 }
 
-void array_push_front(Array *array, void *element) {
-	array->size++;
-	array_scale_capacity(array);
-	memmove(_array_unsafe_at(array, 1), _array_front(array),
-			array->size * array->element_size);
-	memcpy(_array_front(array), element, array->element_size);
+void array_soa_set(ArraySoA *soa, ptrdiff_t index, void *record) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		array_set(soa->columns[i], index, (char *)record + soa->fields[i].offset);
+	}
 }
 
-void array_push_back(Array *array, void *element) {
-	array->size++;
-	array_scale_capacity(array);
-	memcpy(_array_back(array), element, array->element_size);
+bool array_soa_get(ArraySoA *soa, ptrdiff_t index, void *record) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		void *value = _array_at(soa->columns[i], index);
+		if (!value) {
+			return false;
+		}
+		memcpy((char *)record + soa->fields[i].offset, value, soa->fields[i].size);
+	}
+	return soa->field_count > 0;
 }
 
-void *_array_pop_front(Array *array, bool fast) {
-	if (array->size <= 0) {
-		// TODO: Throw error
-		return NULL;
+bool array_soa_pop_back(ArraySoA *soa, void *record) {
+	if (!array_soa_size(soa)) {
+		return false;
 	}
-	if (array->size == 1) {
-		array->size--;
-		return _array_unsafe_at(array, 0);
+	for (size_t i = 0; i < soa->field_count; i++) {
+		void *value = _array_pop_back(soa->columns[i]);
+		if (record) {
+			memcpy((char *)record + soa->fields[i].offset, value,
+					soa->fields[i].size);
+		}
 	}
+	return true;
+}
 
-	memcpy(_array_unsafe_at(array, array->size), _array_at(array, 0),
-			array->element_size);
+void array_soa_remove_at(ArraySoA *soa, ptrdiff_t index) {
+	for (size_t i = 0; i < soa->field_count; i++) {
+		array_remove_at(soa->columns[i], index);
+	}
+}
 
-	array->size--;
+void *array_soa_column(ArraySoA *soa, size_t field) {
+	return field < soa->field_count ? array_data(soa->columns[field]) : NULL;
+}
 
-	// if fast, copy just the last to the front, else everything moves left
-	size_t from = fast ? array->size : 1;
-	size_t n = fast ? 1 : array->size;
+Array *array_soa_field(ArraySoA *soa, size_t field) {
+	return field < soa->field_count ? soa->columns[field] : NULL;
+}
 
-	memmove(_array_at(array, 0), _array_unsafe_at(array, from),
-			n * array->element_size);
-	memcpy(_array_unsafe_at(array, array->size),
-			_array_unsafe_at(array, array->size + 1), array->element_size);
+// Saved arrays are this header then the elements, all in native byte order.
+// Writers don't know count up front, closing goes back and fills it in.
+#define ARRAY_FILE_MAGIC "ARRAYBIN"
+#define ARRAY_FILE_VERSION 1
 
-	array_scale_capacity(array);
+typedef struct ArrayFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t element_size;
+	uint64_t count;
+	uint64_t checksum;
+} ArrayFileHeader;
 
-	return _array_unsafe_at(array, array->size);
+// Hashes 8 bytes at a time, holding on to leftovers so it doesn't matter
+// how the data was split into blocks
+typedef struct ArrayChecksum {
+	uint64_t hash;
+	uint64_t length;
+	unsigned char pending[8];
+	size_t pending_size;
+} ArrayChecksum;
+
+static uint64_t array_checksum_mix(uint64_t hash, const unsigned char *bytes) {
+	uint64_t word;
+	memcpy(&word, bytes, 8);
+	hash = (hash ^ word) * 0x9E3779B97F4A7C15u;
+	return hash ^ (hash >> 29);
 }
 
-void *_array_pop_back(Array *array) {
-	if (array->size <= 0) {
-		// TODO: Throw error
+static void array_checksum_update(ArrayChecksum *checksum, const void *data,
+		size_t size) {
+	const unsigned char *bytes = data;
+	checksum->length += size;
+
+	while (size && checksum->pending_size) {
+		checksum->pending[checksum->pending_size++] = *bytes++;
+		size--;
+		if (checksum->pending_size == 8) {
+			checksum->hash = array_checksum_mix(checksum->hash, checksum->pending);
+			checksum->pending_size = 0;
+		}
+	}
+	for (; size >= 8; size -= 8, bytes += 8) {
+		checksum->hash = array_checksum_mix(checksum->hash, bytes);
+	}
+	memcpy(checksum->pending, bytes, size);
+	checksum->pending_size += size;
+}
+
+static uint64_t array_checksum_final(ArrayChecksum *checksum) {
+	memset(checksum->pending + checksum->pending_size, 0,
+			8 - checksum->pending_size);
+	uint64_t hash = array_checksum_mix(checksum->hash, checksum->pending);
+	hash ^= checksum->length;
+	hash *= 0xBF58476D1CE4E5B9u;
+	return hash ^ (hash >> 31);
+}
+
+struct ArrayWriter {
+	FILE *file;
+	ArrayFileHeader header;
+	ArrayChecksum checksum;
+};
+
+struct ArrayReader {
+	FILE *file;
+	ArrayFileHeader header;
+	ArrayChecksum checksum;
+	uint64_t read;
+};
+
+ArrayWriter *array_writer_open(const char *path, size_t element_size, int flags) {
+	ArrayWriter *writer = malloc(sizeof(ArrayWriter));
+	if (!writer) {
+		printf("malloc failed\n");
 		return NULL;
 	}
 
-	array->size--;
-	array_scale_capacity(array);
+	writer->file = fopen(path, "wb");
+	if (!writer->file) {
+		printf("fopen failed\n");
+		free(writer);
+		return NULL;
+	}
 
-	return _array_unsafe_at(array, array->size);
+	writer->header = (ArrayFileHeader){ ARRAY_FILE_MAGIC, ARRAY_FILE_VERSION,
+		flags, element_size, 0, 0 };
+	writer->checksum = (ArrayChecksum){ 0 };
+	// Placeholder until close knows the count
+	if (fwrite(&writer->header, sizeof(ArrayFileHeader), 1, writer->file) != 1) {
+		printf("fwrite failed\n");
+		fclose(writer->file);
+		free(writer);
+		return NULL;
+	}
+	return writer;
 }
 
-void *_array_pop_at(Array *array, ptrdiff_t index) {
-	void *ptr = _array_at(array, index);
-	if (ptr == _array_front(array)) {
-		return _array_pop_front(array, false);
+bool array_writer_write(ArrayWriter *writer, void *elements, size_t n) {
+	size_t element_size = writer->header.element_size;
+	if (fwrite(elements, element_size, n, writer->file) != n) {
+		printf("fwrite failed\n");
+		return false;
 	}
-	if (ptr == _array_back(array)) {
-		return _array_pop_back(array);
+	if (writer->header.flags & ARRAY_SAVE_CHECKSUM) {
+		array_checksum_update(&writer->checksum, elements, n * element_size);
+	}
+	writer->header.count += n;
+	return true;
+}
+
+bool array_writer_write_array(ArrayWriter *writer, Array *array) {
+	if (array->element_size != writer->header.element_size) {
+		printf("element sizes don't match\n");
+		return false;
 	}
 
-	index = index < 0 ? array->size + index : index;
+	if (array->size == 0) {
+		return true;
+	}
 
-	memmove(_array_unsafe_at(array, array->size), ptr, array->element_size);
-	memmove(ptr, _array_unsafe_at(array, index + 1),
-			(array->size - index) * array->element_size);
+	// Straight out of the buffer, a wrapped deque takes two writes
+	size_t first = array->capacity - array->head;
+	first = first < array->size ? first : array->size;
+	return array_writer_write(writer, _array_at(array, 0), first) &&
+			(first == array->size ||
+					array_writer_write(writer, array->data, array->size - first));
+}
 
-	array->size--;
-	array_scale_capacity(array);
+bool array_writer_close(ArrayWriter *writer) {
+	if (writer->header.flags & ARRAY_SAVE_CHECKSUM) {
+		writer->header.checksum = array_checksum_final(&writer->checksum);
+	}
 
-	return _array_unsafe_at(array, array->size);
+	bool ok = fseek(writer->file, 0, SEEK_SET) == 0 &&
+			fwrite(&writer->header, sizeof(ArrayFileHeader), 1, writer->file) == 1;
+	ok = fclose(writer->file) == 0 && ok;
+	if (!ok) {
+		printf("fwrite failed\n");
+	}
+	free(writer);
+	return ok;
 }
 
-bool array_all(Array *array, bool (*predicate)(void *)) {
-	for (size_t i = 0; i < array->size; i++) {
-		void *element = _array_at(array, i);
-		if (!predicate(element)) {
-			return false;
-		}
+ArrayReader *array_reader_open(const char *path, size_t element_size) {
+	ArrayReader *reader = malloc(sizeof(ArrayReader));
+	if (!reader) {
+		printf("malloc failed\n");
+		return NULL;
 	}
-	return true;
+
+	reader->file = fopen(path, "rb");
+	if (!reader->file) {
+		printf("fopen failed\n");
+		free(reader);
+		return NULL;
+	}
+
+	ArrayFileHeader *header = &reader->header;
+	if (fread(header, sizeof(ArrayFileHeader), 1, reader->file) != 1 ||
+			memcmp(header->magic, ARRAY_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != ARRAY_FILE_VERSION ||
+			header->element_size != element_size) {
+		printf("not a saved array of this element size\n");
+		fclose(reader->file);
+		free(reader);
+		return NULL;
+	}
+
+	// A corrupt count mustn't size anything, it has to fit in what's left
+	long start = ftell(reader->file);
+	long end = fseek(reader->file, 0, SEEK_END) == 0 ? ftell(reader->file) : -1;
+	if (start < 0 || end < start || element_size == 0 ||
+			header->count > (uint64_t)(end - start) / element_size ||
+			fseek(reader->file, start, SEEK_SET) != 0) {
+		printf("saved array is truncated or corrupt\n");
+		fclose(reader->file);
+		free(reader);
+		return NULL;
+	}
+
+	reader->checksum = (ArrayChecksum){ 0 };
+	reader->read = 0;
+	return reader;
 }
 
-bool array_any(Array *array, bool (*predicate)(void *)) {
-	for (size_t i = 0; i < array->size; i++) {
-		void *element = _array_at(array, i);
-		if (predicate(element)) {
-			return true;
-		}
+size_t array_reader_count(ArrayReader *reader) {
+	return reader->header.count;
+}
+
+size_t array_reader_read(ArrayReader *reader, void *elements, size_t n) {
+	uint64_t left = reader->header.count - reader->read;
+	n = n < left ? n : left;
+
+	size_t element_size = reader->header.element_size;
+	n = fread(elements, element_size, n, reader->file);
+	if (reader->header.flags & ARRAY_SAVE_CHECKSUM) {
+		array_checksum_update(&reader->checksum, elements, n * element_size);
 	}
-	return false;
+	reader->read += n;
+	return n;
 }
 
-// Could be parallelized, not the point though.
-Array *array_map(Array *array, void (*map)(void *, void *)) {
-	Array *mapped_array = _array_new(array->element_size);
+bool array_reader_close(ArrayReader *reader) {
+	bool ok = reader->read == reader->header.count;
+	if (ok && reader->header.flags & ARRAY_SAVE_CHECKSUM) {
+		ok = array_checksum_final(&reader->checksum) == reader->header.checksum;
+	}
+	fclose(reader->file);
+	free(reader);
+	return ok;
+}
 
-	void *mapped_element = malloc(array->element_size);
-	if (!mapped_element) {
-		printf("malloc failed\n");
+bool array_save(Array *array, const char *path, int flags) {
+	ArrayWriter *writer = array_writer_open(path, array->element_size, flags);
+	if (!writer) {
+		return false;
+	}
+	bool ok = array_writer_write_array(writer, array);
+	return array_writer_close(writer) && ok;
+}
+
+Array *array_load(const char *path, size_t element_size) {
+	ArrayReader *reader = array_reader_open(path, element_size);
+	if (!reader) {
 		return NULL;
 	}
 
-	for (size_t i = 0; i < array->size; i++) {
-		void *element = _array_at(array, i);
-		map(element, mapped_element);
-		array_push_back(mapped_array, mapped_element);
+	// The reader checked count against the file, this is for size_t
+	// being narrower than the header's count
+	uint64_t count = reader->header.count;
+	if (count >= SIZE_MAX / element_size) {
+		printf("saved array is too big\n");
+		array_reader_close(reader);
+		return NULL;
+	}
+	Array *array = array_new_sized(element_size, count);
+	if (!array || array->capacity <= count) {
+		array_free(array);
+		array_reader_close(reader);
+		return NULL;
 	}
-	free(mapped_element);
 
-	return mapped_array;
+	// One read into the buffer
+	array->size = array_reader_read(reader, array->data, count);
+	if (!array_reader_close(reader)) {
+		printf("saved array is truncated or corrupt\n");
+		array_free(array);
+		return NULL;
+	}
+	return array;
 }
 
-Array *array_filter(Array *array, bool (*filter)(void *)) {
-	Array *filtered_array = _array_new(array->element_size);
-	for (size_t i = 0; i < array->size; i++) {
-		void *element = _array_at(array, i);
-		if (filter(element)) {
-			array_push_back(filtered_array, element);
+#ifdef ARRAY_STATS
+ArrayStats array_stats(Array *array) {
+	return array->stats ? *array->stats : (ArrayStats){ 0 };
+}
+
+void array_stats_reset(Array *array) {
+	ArrayStats *stats = array->stats;
+	if (!stats) {
+		return;
+	}
+	const char *name = stats->name;
+	*stats = (ArrayStats){ .name = name, .element_size = array->element_size };
+	array_stats_resized(array);
+}
+
+void array_stats_set_name(Array *array, const char *name) {
+	if (array->stats) {
+		array->stats->name = name;
+	}
+}
+
+// Names are whatever the caller passed, so quotes, backslashes and control
+// characters get escaped
+static void array_json_string(FILE *file, const char *string) {
+	fputc('"', file);
+	for (const unsigned char *c = (const unsigned char *)string; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fprintf(file, "\\%c", *c);
+		} else if (*c < 0x20) {
+			fprintf(file, "\\u%04x", *c);
+		} else {
+			fputc(*c, file);
 		}
 	}
-	return filtered_array;
+	fputc('"', file);
 }
 
-void array_reduce(Array *array, void (*reduce)(void *, void *),
-		void *accumulator) {
-	for (size_t i = 0; i < array->size; i++) {
-		void *element = _array_at(array, i);
-		reduce(element, accumulator);
+static const char *array_op_names[ARRAY_OPS] = { "push_back", "insert",
+	"remove", "pop", "set", "find", "resize", "sort", "scale" };
+
+void array_stats_dump(FILE *file) {
+	array_stats_lock();
+	fprintf(file, "{\n\t\"arrays\": [");
+	for (ArrayStatsNode *node = array_stats_live; node; node = node->next) {
+		ArrayStats *stats = &node->stats;
+		fprintf(file, "%s\n\t\t{ \"name\": ", node == array_stats_live ? "" : ",");
+		if (stats->name) {
+			array_json_string(file, stats->name);
+		} else {
+			fprintf(file, "null");
+		}
+		fprintf(file, ", \"element_size\": %zu, \"size\": %zu, "
+					  "\"capacity\": %zu, \"peak_size\": %zu, "
+					  "\"peak_capacity\": %zu, \"reallocs\": %zu, "
+					  "\"bytes_moved\": %zu, \"scale_ns\": %zu, \"calls\": {",
+				stats->element_size, stats->size, stats->capacity,
+				stats->peak_size, stats->peak_capacity, stats->reallocs,
+				stats->bytes_moved, stats->scale_ns);
+		for (size_t op = 0; op < ARRAY_OPS; op++) {
+			fprintf(file, "%s\"%s\": %zu", op ? ", " : " ", array_op_names[op],
+					stats->calls[op]);
+		}
+		fprintf(file, " } }");
 	}
+	fprintf(file, array_stats_live ? "\n\t]\n}\n" : "]\n}\n");
+	array_stats_unlock();
+}
+#else
+ArrayStats array_stats(Array *array) {
+	return (ArrayStats){ 0 };
+}
+
+void array_stats_reset(Array *array) {
+}
+
+void array_stats_set_name(Array *array, const char *name) {
+}
+
+void array_stats_dump(FILE *file) {
+	fprintf(file, "{\n\t\"arrays\": []\n}\n");
 }
+#endif
 
 void array_print(Array *array, void (*element_to_string)(char *, void *)) {
 	printf("Array {size: %zu, capacity: %zu, element_size: %zu, data: {",
@@ -501,10 +4826,19 @@ void string_duplicate(char **destination, char **source) {
 	strcpy(*destination, *source);
 }
 
+int int_compare(int *a, int *b) {
+	return (*a > *b) - (*a < *b);
+}
+
 int string_compare(char **a, char **b) {
 	// dereference as, and decide what to compare
 	return strcmp(*a, *b);
 }
+
+size_t string_hash(char **string) {
+	return *string ? array_hash_bytes(*string, strlen(*string)) : 0;
+}
+
 // THINK about it
 void string_free(char **string) {
 	// element could have its own heap allocated memory it frees
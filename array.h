@@ -1,3 +1,6 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
 #include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -6,11 +9,27 @@
 #include <string.h>
 
 #define MIN_CAPACITY 8
+// Arrays of elements up to ARRAY_INLINE_BYTES / MIN_CAPACITY bytes keep this
+// much data inline after their header until they outgrow it
+#define ARRAY_INLINE_BYTES 128
 #define ELEMENT_STRING_BUFFER_SIZE 256
+// Smaller arrays aren't worth waking threads up for, see array_map_par
+#define ARRAY_PARALLEL_THRESHOLD 16384
+#define ARRAY_PARALLEL_MIN_CHUNK 1024
+// Smaller arrays of numbers get introsort instead of radix sort
+#define ARRAY_RADIX_THRESHOLD 64
+// Data at least this big goes in huge pages, see array_set_huge_pages
+#define ARRAY_HUGE_THRESHOLD (2 * 1024 * 1024)
 
 // Macros call _prepended functions with syntactic sugar
 #define array_new(type) _array_new(sizeof(type))
 #define array_new_with_size(type, size) _array_new_with_size(sizeof(type), size)
+#define array_with_capacity(type, capacity) _array_with_capacity(sizeof(type), capacity)
+#define array_new_with_allocator(type, allocator) _array_new_with_allocator(sizeof(type), allocator)
+#define array_new_aligned(type, alignment) _array_new_aligned(sizeof(type), alignment)
+#define array_concurrent_new(type) _array_concurrent_new(sizeof(type))
+#define array_segmented_new(type) _array_segmented_new(sizeof(type))
+#define array_soa_new(type, fields, field_count) _array_soa_new(sizeof(type), fields, field_count)
 
 // All other getters return a pointer, these two are already dereferenced
 // e.g. a[3] = 123; -> array_at(a, int, 3) = 123;
@@ -24,11 +43,265 @@
 #define array_pop_front_fast(array, type) *(type *)_array_pop_front(array, true)
 #define array_pop_back(array, type) *(type *)_array_pop_back(array)
 #define array_pop_at(array, type, index) *(type *)_array_pop_at(array, index)
+#define array_view_at(view, type, index) *(type *)_array_view_at(view, index)
+#define array_concurrent_at(array, type, index) *(type *)_array_concurrent_at(array, index)
+#define array_segmented_at(array, type, index) *(type *)_array_segmented_at(array, index)
+#define array_segmented_pop_back(array, type) *(type *)_array_segmented_pop_back(array)
+
+// array_sort, array_bsearch etc. pick radix sort and numeric ordering for
+// integer and floating point types, anything else is ordered by memcmp
+#define array_sort(array, type) _array_sort(array, ARRAY_KEY(type))
+#define array_bsearch(array, type, element) _array_bsearch(array, ARRAY_KEY(type), element)
+#define array_lower_bound(array, type, element) _array_lower_bound(array, ARRAY_KEY(type), element)
+#define array_upper_bound(array, type, element) _array_upper_bound(array, ARRAY_KEY(type), element)
+#define array_nth_element(array, type, n) _array_nth_element(array, ARRAY_KEY(type), n)
+#define array_partial_sort(array, type, n) _array_partial_sort(array, ARRAY_KEY(type), n)
+#define array_top_k(array, type, k, out) _array_top_k(array, ARRAY_KEY(type), k, out)
+#define array_bottom_k(array, type, k, out) _array_bottom_k(array, ARRAY_KEY(type), k, out)
+
+// accumulator and identity point to the same type, e.g. &sum, &(int){ 0 }
+#define array_reduce_par(array, reduce, combine, accumulator, identity) \
+	_array_reduce_par(array, reduce, combine, accumulator, identity, sizeof(*(accumulator)))
+#define array_iter_reduce_par(iter, reduce, combine, accumulator, identity) \
+	_array_iter_reduce_par(iter, reduce, combine, accumulator, identity, sizeof(*(accumulator)))
+// Map whose results are a different type than what goes in
+#define array_iter_map_to(iter, type, map) _array_iter_map_to(iter, map, sizeof(type))
+
+// Capacity is multiplied by growth_factor when the array fills up, and divided
+// by it once size drops below capacity * shrink_threshold (0.0 never shrinks).
+// Keep shrink_threshold below 1 / growth_factor or push/pop will thrash.
+typedef struct ArrayGrowthPolicy {
+	double growth_factor;
+	size_t min_capacity;
+	double shrink_threshold;
+} ArrayGrowthPolicy;
+
+#define ARRAY_GROWTH_DEFAULT ((ArrayGrowthPolicy){ 2.0, MIN_CAPACITY, 0.25 })
+#define ARRAY_GROWTH_NEVER_SHRINK ((ArrayGrowthPolicy){ 2.0, MIN_CAPACITY, 0.0 })
+
+typedef enum ArrayKey {
+	ARRAY_KEY_BYTES,
+	ARRAY_KEY_SIGNED,
+	ARRAY_KEY_UNSIGNED,
+	ARRAY_KEY_FLOAT,
+} ArrayKey;
+
+#define ARRAY_KEY(type) _Generic((type){ 0 }, \
+		char: (char)-1 < 0 ? ARRAY_KEY_SIGNED : ARRAY_KEY_UNSIGNED, \
+		signed char: ARRAY_KEY_SIGNED, \
+		short: ARRAY_KEY_SIGNED, \
+		int: ARRAY_KEY_SIGNED, \
+		long: ARRAY_KEY_SIGNED, \
+		long long: ARRAY_KEY_SIGNED, \
+		bool: ARRAY_KEY_UNSIGNED, \
+		unsigned char: ARRAY_KEY_UNSIGNED, \
+		unsigned short: ARRAY_KEY_UNSIGNED, \
+		unsigned int: ARRAY_KEY_UNSIGNED, \
+		unsigned long: ARRAY_KEY_UNSIGNED, \
+		unsigned long long: ARRAY_KEY_UNSIGNED, \
+		float: ARRAY_KEY_FLOAT, \
+		double: ARRAY_KEY_FLOAT, \
+		default: ARRAY_KEY_BYTES)
+
+// Where an array gets its header and data buffer from. realloc and free get
+// the old size back, so arenas and pools don't need to store it. NULL
+// functions mean malloc/realloc/free.
+typedef struct ArrayAllocator {
+	void *(*alloc)(void *context, size_t size);
+	void *(*realloc)(void *context, void *pointer, size_t old_size, size_t new_size);
+	void (*free)(void *context, void *pointer, size_t size);
+	void *context;
+} ArrayAllocator;
+
+typedef struct ArrayArena ArrayArena;
+typedef struct ArrayBlockPool ArrayBlockPool;
+
+typedef struct ArrayIndex ArrayIndex;
+typedef struct ArrayMapping ArrayMapping;
+typedef struct ArrayShared ArrayShared;
+typedef struct ArrayConcurrent ArrayConcurrent;
+typedef struct ArraySegmented ArraySegmented;
+typedef struct ArraySoA ArraySoA;
+
+// Where a field sits in a record, e.g. ARRAY_FIELD(Point, x)
+typedef struct ArrayField {
+	size_t offset;
+	size_t size;
+} ArrayField;
+
+#define ARRAY_FIELD(type, member) ((ArrayField){ offsetof(type, member), sizeof(((type *)0)->member) })
+
+// Operations array_stats counts calls of. Most public functions land in
+// one of these, e.g. push_front and insert_at count as inserts.
+typedef enum ArrayOp {
+	ARRAY_OP_PUSH_BACK,
+	ARRAY_OP_INSERT,
+	ARRAY_OP_REMOVE,
+	ARRAY_OP_POP,
+	ARRAY_OP_SET,
+	ARRAY_OP_FIND,
+	ARRAY_OP_RESIZE,
+	ARRAY_OP_SORT,
+	ARRAY_OP_SCALE,
+	ARRAY_OPS,
+} ArrayOp;
+
+// Counters kept per array when built with ARRAY_STATS. bytes_moved is
+// element bytes memmoved or memcpy'd inside the array, a realloc counts as
+// copying the old buffer. size and capacity are as of the last change.
+typedef struct ArrayStats {
+	const char *name;
+	size_t element_size;
+	size_t size;
+	size_t capacity;
+	size_t peak_size;
+	size_t peak_capacity;
+	size_t reallocs;
+	size_t bytes_moved;
+	// Spent in array_scale_capacity, reallocs included
+	size_t scale_ns;
+	size_t calls[ARRAY_OPS];
+} ArrayStats;
+
+// Flags for array_open_mapped
+#define ARRAY_MAP_CREATE 1
+#define ARRAY_MAP_READ_ONLY 2
 
-typedef struct Array Array;
+// Only public so ARRAY_DEFINE's inline functions can reach into it, use the
+// functions below everywhere else
+typedef struct Array {
+	size_t size;
+	size_t capacity;
+	size_t element_size;
+	void (*element_free)(void *);
+	void *data;
+	ArrayGrowthPolicy growth_policy;
+	// Capacity array_reserve asked for, pops don't shrink below it
+	size_t reserved;
+	// Deque mode lets elements start at head and wrap around the buffer
+	size_t head;
+	bool deque;
+	// Comparator the array is kept sorted by, see array_set_keep_sorted
+	int (*order)(void *, void *);
+	// Hash index, see array_enable_index
+	ArrayIndex *index;
+	ArrayAllocator allocator;
+	// Elements that fit in the header's own allocation, 0 for none
+	size_t inline_capacity;
+	// File data lives in, see array_open_mapped
+	ArrayMapping *mapping;
+	// data is aligned to this, 0 for whatever malloc gives
+	size_t alignment;
+	// Opted into huge pages, and whether data is in its own mapping now
+	bool huge_pages;
+	bool huge;
+	// Duplicates share data until one of them changes, see
+	// array_set_copy_on_write
+	bool copy_on_write;
+	ArrayShared *shared;
+#ifdef ARRAY_STATS
+	// Last so the fields above sit in the same place either way
+	ArrayStats *stats;
+#endif
+} Array;
+
+#define ARRAY_ITER_MAX_STAGES 8
+
+typedef enum ArrayIterKind {
+	ARRAY_ITER_MAP,
+	ARRAY_ITER_FILTER,
+	ARRAY_ITER_TAKE,
+} ArrayIterKind;
+
+typedef struct ArrayIterStage {
+	ArrayIterKind kind;
+	void (*map)(void *, void *);
+	bool (*filter)(void *);
+	size_t take;
+	// Size of the elements coming out of this stage
+	size_t element_size;
+} ArrayIterStage;
+
+// Lazy pipeline over an array, built up by value and only run by the
+// reduce/collect/count at the end. NULL array means it was built wrong.
+typedef struct ArrayIter {
+	Array *array;
+	size_t element_size;
+	size_t stage_count;
+	ArrayIterStage stages[ARRAY_ITER_MAX_STAGES];
+} ArrayIter;
+
+// Read-only window into an array's elements, doesn't own anything. Good
+// until the array is changed or freed.
+typedef struct ArrayView {
+	void *data;
+	size_t size;
+	// Bytes from one element to the next, element_size unless stepped
+	size_t stride;
+	size_t element_size;
+} ArrayView;
 
 Array *_array_new(size_t type_size);
 Array *_array_new_with_size(size_t type_size, size_t size);
+Array *_array_with_capacity(size_t type_size, size_t capacity);
+// NULL allocator is malloc. Duplicates, map and filter results use the same
+// allocator as the array they came from.
+Array *_array_new_with_allocator(size_t type_size, const ArrayAllocator *allocator);
+// data starts on a multiple of alignment (a power of two, e.g. 64 for cache
+// lines or AVX-512) however the array grows or shrinks. Uses aligned_alloc,
+// arrays made from it (duplicates, map) aren't aligned.
+Array *_array_new_aligned(size_t type_size, size_t alignment);
+
+// Array whose data is an mmap of path, so opening a big one only faults in
+// the pages that get used, and processes mapping the same file share them.
+// ARRAY_MAP_CREATE makes the file if it's missing, growing extends it.
+// ARRAY_MAP_READ_ONLY maps it without write access, so only use functions
+// that don't change the array. array_free saves the size and unmaps,
+// array_sync also flushes the pages to disk.
+Array *array_open_mapped(const char *path, size_t element_size, int flags);
+bool array_sync(Array *array);
+bool array_is_mapped(Array *array);
+
+// Flags for array_save and array_writer_open
+#define ARRAY_SAVE_CHECKSUM 1
+
+typedef struct ArrayWriter ArrayWriter;
+typedef struct ArrayReader ArrayReader;
+
+// Binary files with a header (magic, version, element size, count and an
+// optional checksum) and the raw elements, in this machine's byte order.
+// Elements are copied as is, so pointers inside them don't survive.
+bool array_save(Array *array, const char *path, int flags);
+Array *array_load(const char *path, size_t element_size);
+
+// Streams the same format a block of elements at a time, so arrays too big
+// for memory can be spilled and read back. array_reader_read returns how
+// many elements it read, 0 at the end. array_reader_close returns false
+// unless everything was read and the checksum matched.
+ArrayWriter *array_writer_open(const char *path, size_t element_size, int flags);
+bool array_writer_write(ArrayWriter *writer, void *elements, size_t n);
+bool array_writer_write_array(ArrayWriter *writer, Array *array);
+bool array_writer_close(ArrayWriter *writer);
+
+ArrayReader *array_reader_open(const char *path, size_t element_size);
+size_t array_reader_count(ArrayReader *reader);
+size_t array_reader_read(ArrayReader *reader, void *elements, size_t n);
+bool array_reader_close(ArrayReader *reader);
+
+// Bump allocator, freeing only gives back the latest allocation. Reset
+// releases everything at once, arrays allocated from it are gone without
+// array_free (so element_free isn't called either). Not thread safe.
+ArrayArena *array_arena_new(size_t block_size);
+ArrayAllocator array_arena_allocator(ArrayArena *arena);
+void array_arena_reset(ArrayArena *arena);
+void array_arena_free(ArrayArena *arena);
+
+// Like the arena but freed blocks go to a free list per power of two size
+// class and get reused, for arrays that come and go between resets
+ArrayBlockPool *array_block_pool_new(void);
+ArrayAllocator array_block_pool_allocator(ArrayBlockPool *pool);
+void array_block_pool_reset(ArrayBlockPool *pool);
+void array_block_pool_free(ArrayBlockPool *pool);
 
 void array_free(Array *array);
 void array_set_element_free(Array *array, void (*p_element_free)(void *));
@@ -36,6 +309,16 @@ void array_set_element_free(Array *array, void (*p_element_free)(void *));
 Array *array_duplicate(Array *array);
 Array *array_duplicate_custom(Array *array, void (*element_duplicate)(void *, void *));
 
+// With copy-on-write on, array_duplicate is O(1): the duplicate shares the
+// data and whichever one changes first (set, push, insert, remove, resize,
+// sort...) copies it then. Duplicates inherit the mode. Pointers from
+// array_at are only for reading while shared, array_data gets a private
+// copy since callers write through it. Shared copies can live on different
+// threads. element_duplicate always copies.
+void array_set_copy_on_write(Array *array, bool copy_on_write);
+// Whether the data is currently shared with another array
+bool array_is_shared(Array *array);
+
 size_t array_size(Array *array);
 size_t array_capacity(Array *array);
 size_t array_element_size(Array *array);
@@ -55,10 +338,76 @@ size_t array_count_custom(Array *array, int (*compare)(void *, void *), void *el
 void array_clear(Array *array);
 void array_reverse(Array *array);
 
+void _array_sort(Array *array, ArrayKey key);
+void array_sort_custom(Array *array, int (*compare)(void *, void *));
+
+// Moves the element that belongs at index n when sorted there, with nothing
+// bigger before it and nothing smaller after, in O(n). Returns it, NULL if
+// n is out of range. Supports negative indexing like array_at.
+void *_array_nth_element(Array *array, ArrayKey key, ptrdiff_t n);
+void *array_nth_element_custom(Array *array, int (*compare)(void *, void *), ptrdiff_t n);
+// Sorts just the n smallest into the front, the rest end up in any order
+void _array_partial_sort(Array *array, ArrayKey key, size_t n);
+void array_partial_sort_custom(Array *array, int (*compare)(void *, void *), size_t n);
+// Fills out with the k largest, biggest first, in one pass that leaves
+// array alone. bottom_k is the k smallest, smallest first.
+void _array_top_k(Array *array, ArrayKey key, size_t k, Array *out);
+void array_top_k_custom(Array *array, int (*compare)(void *, void *), size_t k, Array *out);
+void _array_bottom_k(Array *array, ArrayKey key, size_t k, Array *out);
+void array_bottom_k_custom(Array *array, int (*compare)(void *, void *), size_t k, Array *out);
+
+// Binary searches need the array sorted the same way
+ptrdiff_t _array_bsearch(Array *array, ArrayKey key, void *element);
+ptrdiff_t array_bsearch_custom(Array *array, int (*compare)(void *, void *), void *element);
+size_t _array_lower_bound(Array *array, ArrayKey key, void *element);
+size_t array_lower_bound_custom(Array *array, int (*compare)(void *, void *), void *element);
+size_t _array_upper_bound(Array *array, ArrayKey key, void *element);
+size_t array_upper_bound_custom(Array *array, int (*compare)(void *, void *), void *element);
+
+// Sorts the array by compare and remembers it, array_insert_sorted keeps it
+// that way and array_find/count/contains_custom with the same compare
+// binary search. Other inserts, sets, sorts and reorders drop it, so the array
+// goes back to linear search, NULL turns it off. Writes through array_data
+// aren't tracked, turn it off first.
+void *array_keep_sorted(Array *array);
+void array_set_keep_sorted(Array *array, int (*compare)(void *, void *));
+void array_insert_sorted(Array *array, void *element);
+
 void array_resize(Array *array, size_t new_size);
+// Pops don't shrink capacity below this again until array_clear or
+// array_shrink_to_fit, the growth policy itself is left alone
+void array_reserve(Array *array, size_t capacity);
 void array_scale_capacity(Array *array);
+// Down to size + 1, the slot past size is always kept free for pops
 void array_shrink_to_fit(Array *array);
 
+// Deque mode stores elements in a ring buffer so pushing and popping at
+// either end is O(1), array_data() makes it contiguous again when called
+bool array_is_deque(Array *array);
+void array_set_deque(Array *array, bool deque);
+
+// Once data reaches ARRAY_HUGE_THRESHOLD bytes it moves to its own
+// anonymous mmap with transparent huge pages asked for, so big arrays take
+// fewer TLB misses. The mapping is whole 2 MiB huge pages starting on one,
+// so all of it can be backed by them. Growing it uses mremap, which moves
+// pages instead of copying bytes. Falls back to the heap below the
+// threshold. Mapped files and alignments over 2 MiB don't use it.
+void array_set_huge_pages(Array *array, bool huge_pages);
+bool array_is_huge(Array *array);
+
+// Keeps a hash table of where elements are, so array_find/contains/count
+// (or the _custom ones when given the same compare) take expected O(1).
+// NULL hash hashes the element bytes, NULL compare uses memcmp. Writing
+// through array_at/array_get/array_data skips the index, use array_set or
+// call array_rebuild_index after.
+bool array_enable_index(Array *array, size_t (*hash)(void *), int (*compare)(void *, void *));
+void array_disable_index(Array *array);
+void array_rebuild_index(Array *array);
+bool array_has_index(Array *array);
+
+ArrayGrowthPolicy array_growth_policy(Array *array);
+void array_set_growth_policy(Array *array, ArrayGrowthPolicy policy);
+
 void *_array_at(Array *array, ptrdiff_t index);
 void *_array_unsafe_at(Array *array, ptrdiff_t index);
 
@@ -68,23 +417,202 @@ void *_array_get(Array *array, ptrdiff_t index);
 void array_insert_at(Array *array, ptrdiff_t index, void *element);
 void array_remove_at(Array *array, ptrdiff_t index);
 
+void array_insert_range(Array *array, ptrdiff_t index, void *elements, size_t n);
+void array_remove_range(Array *array, ptrdiff_t start, ptrdiff_t end);
+
 void array_remove(Array *array, void *element);
 void array_remove_custom(Array *array, int (*compare)(void *, void *), void *element);
 
+// Remove every match in one pass, element_free runs once per removed
+// element and capacity shrinks at most once. dedup_adjacent keeps the first
+// of each run of equal elements, so on a sorted array it leaves one of each.
+// With element_free set, don't pass one of the array's own elements to
+// remove_all, it gets freed before the rest are compared with it.
+void array_remove_all(Array *array, void *element);
+void array_remove_all_custom(Array *array, int (*compare)(void *, void *), void *element);
+void array_remove_if(Array *array, bool (*remove)(void *));
+void array_dedup_adjacent(Array *array);
+void array_dedup_adjacent_custom(Array *array, int (*compare)(void *, void *));
+
 void *_array_front(Array *array);
 void *_array_back(Array *array);
 
 void array_push_front(Array *array, void *element);
 void array_push_back(Array *array, void *element);
 
+// Copies are shallow like array_push_back, elements aren't duplicated
+void array_push_back_n(Array *array, void *elements, size_t n);
+void array_append_array(Array *array, Array *other);
+
 void *_array_pop_front(Array *array, bool fast);
 void *_array_pop_back(Array *array);
 void *_array_pop_at(Array *array, ptrdiff_t index);
 
+// Move elements out into a caller's buffer in one go, one memmove at most
+// however many there are. out gets them in array order and owns them, so
+// element_free isn't called. Return how many were moved, n is capped at size.
+size_t array_pop_front_into(Array *array, void *out, size_t n);
+size_t array_pop_back_into(Array *array, void *out, size_t n);
+// Moves [start, end) out, both support negative indexing
+size_t array_drain(Array *array, ptrdiff_t start, ptrdiff_t end, void *out);
+
 Array *array_map(Array *array, void (*map)(void *, void *));
 Array *array_filter(Array *array, bool (*filter)(void *));
 void array_reduce(Array *array, void (*reduce)(void *, void *), void *accumulator);
 
+// In place versions of filter and map, no new Array. array_retain keeps
+// elements retain returns true for, compacting in one pass and calling
+// element_free on the rest. array_transform replaces every element with
+// transform(element, result), the old one isn't freed. array_transform_into
+// writes the results into out instead (any element size), reusing its
+// buffer so a reserved out never reallocates.
+void array_retain(Array *array, bool (*retain)(void *));
+void array_transform(Array *array, void (*transform)(void *, void *));
+void array_transform_into(Array *array, Array *out, void (*transform)(void *, void *));
+
+// Parallel versions split arrays of at least the threshold size into chunks
+// for a pool of worker threads, smaller ones just call the serial version.
+// map/filter/reduce functions have to be safe to call from several threads.
+// _par calls from inside one of them run on that thread, while
+// array_set_parallel_threads and array_parallel_shutdown there would
+// deadlock. Threads default to the number of cores, build with
+// ARRAY_NO_THREADS to run everything on the calling thread.
+Array *array_map_par(Array *array, void (*map)(void *, void *));
+Array *array_filter_par(Array *array, bool (*filter)(void *));
+// Each chunk reduces into its own copy of identity, then those are combined
+// into accumulator in order with combine(partial, accumulator)
+void _array_reduce_par(Array *array, void (*reduce)(void *, void *), void (*combine)(void *, void *), void *accumulator, void *identity, size_t accumulator_size);
+
+void array_set_parallel_threshold(size_t threshold);
+void array_set_parallel_threads(size_t threads);
+void array_parallel_shutdown(void);
+
+// e.g. sum of even squares in one pass, no arrays in between:
+// array_iter_reduce(array_iter_filter(array_iter_map(array_iter(a),
+//		int_squared), int_even), int_summation, &sum);
+// Every element goes through all the stages before the next one starts,
+// take(n) stops the whole pass once n elements have got through it. The
+// _par versions split the pass into chunks like array_reduce_par, unless
+// there's a take (it needs the order) or the array is under the threshold.
+ArrayIter array_iter(Array *array);
+ArrayIter array_iter_map(ArrayIter iter, void (*map)(void *, void *));
+ArrayIter _array_iter_map_to(ArrayIter iter, void (*map)(void *, void *), size_t result_size);
+ArrayIter array_iter_filter(ArrayIter iter, bool (*filter)(void *));
+ArrayIter array_iter_take(ArrayIter iter, size_t n);
+
+void array_iter_reduce(ArrayIter iter, void (*reduce)(void *, void *), void *accumulator);
+void _array_iter_reduce_par(ArrayIter iter, void (*reduce)(void *, void *), void (*combine)(void *, void *), void *accumulator, void *identity, size_t accumulator_size);
+// New Array of what comes out, NULL for a pipeline that was built wrong
+Array *array_iter_collect(ArrayIter iter);
+Array *array_iter_collect_par(ArrayIter iter);
+size_t array_iter_count(ArrayIter iter);
+
+// Views are passed by value and copy nothing, e.g. hand each thread its own
+// slice. start and end work like Python slices: negative counts from the
+// back, out of range gets clamped, end is exclusive. A wrapped deque is made
+// contiguous first.
+ArrayView array_view(Array *array);
+ArrayView array_slice(Array *array, ptrdiff_t start, ptrdiff_t end);
+ArrayView array_view_slice(ArrayView view, ptrdiff_t start, ptrdiff_t end);
+// Every step-th element, array_view_step(view, 2) is the even indices
+ArrayView array_view_step(ArrayView view, size_t step);
+size_t array_view_size(ArrayView view);
+void *_array_view_at(ArrayView view, ptrdiff_t index);
+
+ptrdiff_t array_view_find(ArrayView view, void *element);
+ptrdiff_t array_view_find_custom(ArrayView view, int (*compare)(void *, void *), void *element);
+bool array_view_contains(ArrayView view, void *element);
+bool array_view_contains_custom(ArrayView view, int (*compare)(void *, void *), void *element);
+size_t array_view_count(ArrayView view, void *element);
+size_t array_view_count_custom(ArrayView view, int (*compare)(void *, void *), void *element);
+
+// Results are new arrays with malloc, like array_map and array_filter
+Array *array_view_map(ArrayView view, void (*map)(void *, void *));
+Array *array_view_filter(ArrayView view, bool (*filter)(void *));
+void array_view_reduce(ArrayView view, void (*reduce)(void *, void *), void *accumulator);
+void array_view_print(ArrayView view, void (*element_to_string)(char *, void *));
+
+// Append-only array any number of threads can push to at once. Pushes grab
+// slots with an atomic add and copy in without locking. Storage is a list
+// of doubling segments that never move, so pointers from array_concurrent_at
+// stay valid until array_concurrent_free. Pushes publish in order once copied
+// in, size counts published elements and anything below it is safe to read
+// from any thread while others push.
+ArrayConcurrent *_array_concurrent_new(size_t type_size);
+void array_concurrent_free(ArrayConcurrent *array);
+// Return the index of the (first) element pushed, SIZE_MAX if out of memory.
+// A failed push reserves nothing, so indices stay contiguous. A push returns
+// once every earlier push has published too.
+size_t array_concurrent_push(ArrayConcurrent *array, void *element);
+size_t array_concurrent_push_n(ArrayConcurrent *array, void *elements, size_t n);
+size_t array_concurrent_size(ArrayConcurrent *array);
+void *_array_concurrent_at(ArrayConcurrent *array, size_t index);
+// Copies everything published so far into a regular Array
+Array *array_concurrent_collect(ArrayConcurrent *array);
+
+// Single threaded array with the same doubling segments, for big append
+// heavy arrays. Growing allocates a new segment instead of copying, so
+// pointers to elements stay valid until they're popped or the array is
+// cleared or freed, and there's no latency spike at each doubling. Access
+// is still O(1). Indices support negative indexing like array_at.
+ArraySegmented *_array_segmented_new(size_t type_size);
+void array_segmented_free(ArraySegmented *array);
+size_t array_segmented_size(ArraySegmented *array);
+size_t array_segmented_capacity(ArraySegmented *array);
+bool array_segmented_reserve(ArraySegmented *array, size_t capacity);
+// Return where the element now lives, NULL if out of memory
+void *array_segmented_push_back(ArraySegmented *array, void *element);
+bool array_segmented_push_back_n(ArraySegmented *array, void *elements, size_t n);
+void *_array_segmented_at(ArraySegmented *array, ptrdiff_t index);
+void array_segmented_set(ArraySegmented *array, ptrdiff_t index, void *element);
+// The element stays where it was until the slot is pushed over again
+void *_array_segmented_pop_back(ArraySegmented *array);
+// Keeps the segments for reuse
+void array_segmented_clear(ArraySegmented *array);
+// Slot index and how many slots follow it contiguously, for looping a
+// segment at a time
+void *array_segmented_chunk(ArraySegmented *array, size_t index, size_t *count);
+Array *array_segmented_collect(ArraySegmented *array);
+
+// Build everything with ARRAY_STATS defined to count, without it these
+// return zeros and dump an empty list, and nothing else pays for them.
+// Arrays register when created and leave on array_free, ones an arena
+// reset got rid of stay listed. Pushes through ARRAY_DEFINE's inline push
+// that don't need to grow aren't counted.
+ArrayStats array_stats(Array *array);
+void array_stats_reset(Array *array);
+// Shows up in the dump, name has to outlive the array
+void array_stats_set_name(Array *array, const char *name);
+// JSON list of every live array's stats
+void array_stats_dump(FILE *file);
+
+// Stores records field by field, each field in its own column, so a loop
+// over one field only pulls that field through cache and vectorizes. Records
+// go in and come out whole, bytes between fields aren't kept. Indices
+// support negative indexing like array_at.
+// e.g. ArrayField fields[] = { ARRAY_FIELD(Point, x), ARRAY_FIELD(Point, y) };
+//		ArraySoA *points = array_soa_new(Point, fields, 2);
+ArraySoA *_array_soa_new(size_t record_size, const ArrayField *fields, size_t field_count);
+void array_soa_free(ArraySoA *soa);
+size_t array_soa_size(ArraySoA *soa);
+size_t array_soa_field_count(ArraySoA *soa);
+void array_soa_reserve(ArraySoA *soa, size_t capacity);
+void array_soa_clear(ArraySoA *soa);
+
+void array_soa_push_back(ArraySoA *soa, void *record);
+void array_soa_insert_at(ArraySoA *soa, ptrdiff_t index, void *record);
+void array_soa_set(ArraySoA *soa, ptrdiff_t index, void *record);
+// Copy the record into record, false if index is out of range or it's empty
+bool array_soa_get(ArraySoA *soa, ptrdiff_t index, void *record);
+bool array_soa_pop_back(ArraySoA *soa, void *record);
+void array_soa_remove_at(ArraySoA *soa, ptrdiff_t index);
+
+// Contiguous values of one field, valid until the next push or remove
+void *array_soa_column(ArraySoA *soa, size_t field);
+// The column as an Array, for array_reduce, array_iter, array_sort etc. on
+// one field. Only change values through it, not the size.
+Array *array_soa_field(ArraySoA *soa, size_t field);
+
 void array_print(Array *array, void (*element_to_string)(char *, void *));
 
 // Example functions for print, map, filter, reduce
@@ -97,6 +625,97 @@ void stos(char *buffer, char **element);
 void int_squared(int *element, int *result);
 bool int_even(int *element);
 void int_summation(int *element, int *accumulator);
+int int_compare(int *a, int *b);
 void string_duplicate(char **destination, char **source);
 int string_compare(char **a, char **b);
-void string_free(char **string);
\ No newline at end of file
+size_t string_hash(char **string);
+void string_free(char **string);
+
+// Generates a typed handle around an Array of T, plus static inline functions
+// the compiler can inline with sizeof(T) known. a.array is a regular Array,
+// everything above works on it too.
+// e.g. ARRAY_DEFINE(IntArray, int) -> IntArray a = IntArray_new(); IntArray_push(a, 3);
+#define ARRAY_DEFINE(name, T) \
+	typedef struct name { \
+		Array *array; \
+	} name; \
+\
+	static inline name name##_new(void) { \
+		return (name){ _array_new(sizeof(T)) }; \
+	} \
+\
+	static inline name name##_wrap(Array *array) { \
+		return (name){ array && array->element_size == sizeof(T) ? array : NULL }; \
+	} \
+\
+	static inline void name##_free(name a) { \
+		array_free(a.array); \
+	} \
+\
+	static inline size_t name##_size(name a) { \
+		return a.array->size; \
+	} \
+\
+	static inline T *name##_data(name a) { \
+		return (T *)array_data(a.array); \
+	} \
+\
+	static inline T *name##_at(name a, ptrdiff_t index) { \
+		Array *array = a.array; \
+		if (index < 0) { \
+			index += array->size; \
+		} \
+		if (index < 0 || (size_t)index >= array->size) { \
+			return NULL; \
+		} \
+		size_t i = array->head + index; \
+		if (i >= array->capacity) { \
+			i -= array->capacity; \
+		} \
+		return (T *)array->data + i; \
+	} \
+\
+	static inline void name##_push(name a, T element) { \
+		Array *array = a.array; \
+		/* Room left without touching the slot past size, no realloc, */ \
+		/* no copy-on-write data to copy first and no order to drop */ \
+		if (array->size + 1 < array->capacity && !array->index && \
+				!array->shared && !array->order) { \
+			size_t i = array->head + array->size; \
+			if (i >= array->capacity) { \
+				i -= array->capacity; \
+			} \
+			((T *)array->data)[i] = element; \
+			array->size++; \
+			return; \
+		} \
+		array_push_back(array, &element); \
+	} \
+\
+	static inline T name##_pop(name a) { \
+		T *element = (T *)_array_pop_back(a.array); \
+		return element ? *element : (T){ 0 }; \
+	} \
+\
+	static inline ptrdiff_t name##_find(name a, T element) { \
+		T *data = name##_data(a); \
+		for (size_t i = 0; i < a.array->size; i++) { \
+			if (memcmp(&data[i], &element, sizeof(T)) == 0) { \
+				return i; \
+			} \
+		} \
+		return -1; \
+	} \
+\
+	static inline name name##_map(name a, T (*map)(T)) { \
+		size_t size = a.array->size; \
+		name mapped = { _array_new_with_size(sizeof(T), size) }; \
+		T *in = name##_data(a); \
+		T *out = (T *)mapped.array->data; \
+		for (size_t i = 0; i < size; i++) { \
+			out[i] = map(in[i]); \
+		} \
+		return mapped; \
+	}
+
+#endif // ARRAY_H
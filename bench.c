@@ -0,0 +1,709 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "array.h"
+
+// Every benchmark runs at least this many operations, short ones get repeated
+#define BENCH_MIN_OPS 200000
+// Operations that are O(size) each only run this many times per round
+#define BENCH_LINEAR_OPS 256
+#define BENCH_MAX_LIST 16
+
+typedef enum BenchPattern {
+	BENCH_SEQUENTIAL,
+	BENCH_RANDOM,
+} BenchPattern;
+
+typedef enum BenchFormat {
+	BENCH_TABLE,
+	BENCH_CSV,
+	BENCH_JSON,
+} BenchFormat;
+
+typedef struct BenchCase {
+	Array *array;
+	size_t size;
+	size_t element_size;
+	size_t ops;
+	// ops indices into [0, size), sequential or random
+	size_t *indices;
+	unsigned char *element;
+	// Filled in by the benchmark
+	size_t bytes;
+	size_t sink;
+	// Time of the part worth measuring, for runs with setup that shouldn't
+	// count. 0 times the whole run.
+	double timed;
+} BenchCase;
+
+typedef struct Benchmark {
+	const char *name;
+	// Start from size elements instead of an empty array
+	bool filled;
+	bool deque;
+	// Each operation is O(size), only run BENCH_LINEAR_OPS of them
+	bool linear;
+	// Looks at indices, gets run with both patterns
+	bool indexed;
+	// One call over the whole array, ns/op is per element
+	bool whole;
+	void (*run)(BenchCase *bench);
+} Benchmark;
+
+static size_t bench_element_size;
+
+// Threaded benchmarks run once per count, 1, 2, 4... up to the cores
+static size_t bench_threads = 1;
+
+static uint64_t bench_random_state = 0x2545F4914F6CDD1Du;
+
+static uint64_t bench_random(void) {
+	bench_random_state ^= bench_random_state << 13;
+	bench_random_state ^= bench_random_state >> 7;
+	bench_random_state ^= bench_random_state << 17;
+	return bench_random_state;
+}
+
+static double bench_now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static long bench_peak_rss_kb(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// Element i is i's bytes repeated, so no two elements under 2^8 are equal
+static void bench_element(unsigned char *element, size_t element_size,
+		size_t i) {
+	for (size_t j = 0; j < element_size; j++) {
+		element[j] = (unsigned char)(i >> (8 * (j % sizeof(size_t))));
+	}
+}
+
+// Callbacks for map/filter/reduce/sort over any element size
+static void bench_map(void *element, void *result) {
+	memcpy(result, element, bench_element_size);
+	*(unsigned char *)result += 1;
+}
+
+static bool bench_filter(void *element) {
+	return *(unsigned char *)element & 1;
+}
+
+static void bench_reduce(void *element, void *accumulator) {
+	*(size_t *)accumulator += *(unsigned char *)element;
+}
+
+static void bench_combine(void *partial, void *accumulator) {
+	*(size_t *)accumulator += *(size_t *)partial;
+}
+
+static int bench_compare(void *a, void *b) {
+	return memcmp(a, b, bench_element_size);
+}
+
+static void bench_push_back(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		array_push_back(bench->array, bench->element);
+	}
+	bench->bytes = bench->ops * bench->element_size;
+}
+
+// Same pushes, on an array that moves to huge pages past the threshold
+static void bench_push_back_huge(BenchCase *bench) {
+	bench_push_back(bench);
+}
+
+// Same pushes, growth adds a segment instead of copying everything
+static void bench_push_back_segmented(BenchCase *bench) {
+	ArraySegmented *segmented = _array_segmented_new(bench->element_size);
+	for (size_t i = 0; i < bench->ops; i++) {
+		array_segmented_push_back(segmented, bench->element);
+	}
+	bench->bytes = bench->ops * bench->element_size;
+	bench->sink += array_segmented_size(segmented);
+	array_segmented_free(segmented);
+}
+
+static void bench_push_front(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench->bytes += array_size(bench->array) * bench->element_size;
+		array_push_front(bench->array, bench->element);
+	}
+}
+
+static void bench_push_front_deque(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		array_push_front(bench->array, bench->element);
+	}
+	bench->bytes = bench->ops * bench->element_size;
+}
+
+static void bench_pop_back(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench->sink += *(unsigned char *)_array_pop_back(bench->array);
+	}
+}
+
+static void bench_pop_front(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench->bytes += array_size(bench->array) * bench->element_size;
+		bench->sink += *(unsigned char *)_array_pop_front(bench->array, false);
+	}
+}
+
+static void bench_pop_front_deque(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench->sink += *(unsigned char *)_array_pop_front(bench->array, false);
+	}
+}
+
+// Empties the array in batches, one memmove per batch instead of per pop
+static void bench_pop_front_into(BenchCase *bench) {
+	unsigned char *batch = malloc(64 * bench->element_size);
+	while (array_pop_front_into(bench->array, batch, 64)) {
+		bench->sink += batch[0];
+	}
+	bench->bytes = bench->size * bench->element_size;
+	free(batch);
+}
+
+static void bench_at(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench->sink += *(unsigned char *)_array_at(bench->array, bench->indices[i]);
+	}
+}
+
+static void bench_set(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		array_set(bench->array, bench->indices[i], bench->element);
+	}
+	bench->bytes = bench->ops * bench->element_size;
+}
+
+static void bench_insert_at(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		size_t index = bench->indices[i] % array_size(bench->array);
+		bench->bytes += (array_size(bench->array) - index) * bench->element_size;
+		array_insert_at(bench->array, index, bench->element);
+	}
+}
+
+static void bench_remove_at(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops && !array_empty(bench->array); i++) {
+		size_t index = bench->indices[i] % array_size(bench->array);
+		bench->bytes += (array_size(bench->array) - index - 1) * bench->element_size;
+		array_remove_at(bench->array, index);
+	}
+}
+
+// Drops every other element, in one pass
+static void bench_remove_if(BenchCase *bench) {
+	array_remove_if(bench->array, bench_filter);
+	bench->bytes = (bench->size + array_size(bench->array)) * bench->element_size;
+}
+
+static void bench_push_back_n(BenchCase *bench) {
+	unsigned char *elements = calloc(bench->size, bench->element_size);
+	array_push_back_n(bench->array, elements, bench->size);
+	bench->bytes = bench->size * bench->element_size;
+	free(elements);
+}
+
+static void bench_insert_range(BenchCase *bench) {
+	// Doubles the array by inserting a copy of it in the middle
+	Array *copy = array_duplicate(bench->array);
+	size_t middle = bench->size / 2;
+	array_insert_range(bench->array, middle, array_data(copy), bench->size);
+	bench->bytes = (bench->size + bench->size - middle) * bench->element_size;
+	array_free(copy);
+}
+
+static void bench_remove_range(BenchCase *bench) {
+	size_t quarter = bench->size / 4;
+	array_remove_range(bench->array, quarter, bench->size - quarter);
+	bench->bytes = quarter * bench->element_size;
+}
+
+static void bench_find(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		ptrdiff_t index = array_find(bench->array, bench->element);
+		size_t scanned = index == -1 ? bench->size : (size_t)index + 1;
+		bench->bytes += scanned * bench->element_size;
+	}
+}
+
+static void bench_count(BenchCase *bench) {
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench->sink += array_count(bench->array, bench->element);
+	}
+	bench->bytes = bench->ops * bench->size * bench->element_size;
+}
+
+static void bench_contains_indexed(BenchCase *bench) {
+	array_enable_index(bench->array, NULL, NULL);
+	double start = bench_now();
+	for (size_t i = 0; i < bench->ops; i++) {
+		bench_element(bench->element, bench->element_size, bench->indices[i]);
+		bench->sink += array_contains(bench->array, bench->element);
+	}
+	// Building the index isn't part of the lookups
+	bench->timed = bench_now() - start;
+}
+
+static void bench_map_whole(BenchCase *bench) {
+	Array *mapped = array_map(bench->array, bench_map);
+	bench->bytes = 2 * bench->size * bench->element_size;
+	array_free(mapped);
+}
+
+static void bench_map_par(BenchCase *bench) {
+	Array *mapped = array_map_par(bench->array, bench_map);
+	bench->bytes = 2 * bench->size * bench->element_size;
+	array_free(mapped);
+}
+
+static void bench_filter_whole(BenchCase *bench) {
+	Array *filtered = array_filter(bench->array, bench_filter);
+	bench->bytes = (bench->size + array_size(filtered)) * bench->element_size;
+	array_free(filtered);
+}
+
+static void bench_filter_par(BenchCase *bench) {
+	Array *filtered = array_filter_par(bench->array, bench_filter);
+	bench->bytes = (bench->size + array_size(filtered)) * bench->element_size;
+	array_free(filtered);
+}
+
+static void bench_reduce_whole(BenchCase *bench) {
+	size_t sum = 0;
+	array_reduce(bench->array, bench_reduce, &sum);
+	bench->sink += sum;
+	bench->bytes = bench->size * bench->element_size;
+}
+
+static void bench_reduce_par(BenchCase *bench) {
+	size_t sum = 0;
+	array_reduce_par(bench->array, bench_reduce, bench_combine, &sum, &(size_t){ 0 });
+	bench->sink += sum;
+	bench->bytes = bench->size * bench->element_size;
+}
+
+// Same work as iter_pipeline, one array_map/filter/reduce after another
+static void bench_chained(BenchCase *bench) {
+	Array *mapped = array_map(bench->array, bench_map);
+	Array *filtered = array_filter(mapped, bench_filter);
+	size_t sum = 0;
+	array_reduce(filtered, bench_reduce, &sum);
+	bench->sink += sum;
+	bench->bytes = (3 * bench->size + 2 * array_size(filtered)) * bench->element_size;
+	array_free(mapped);
+	array_free(filtered);
+}
+
+static void bench_iter_pipeline(BenchCase *bench) {
+	size_t sum = 0;
+	array_iter_reduce(array_iter_filter(array_iter_map(array_iter(bench->array),
+									  bench_map),
+							  bench_filter),
+			bench_reduce, &sum);
+	bench->sink += sum;
+	bench->bytes = bench->size * bench->element_size;
+}
+
+static void bench_iter_pipeline_par(BenchCase *bench) {
+	size_t sum = 0;
+	array_iter_reduce_par(array_iter_filter(array_iter_map(array_iter(bench->array),
+										  bench_map),
+								  bench_filter),
+			bench_reduce, bench_combine, &sum, &(size_t){ 0 });
+	bench->sink += sum;
+	bench->bytes = bench->size * bench->element_size;
+}
+
+static bool bench_keyed(size_t element_size) {
+	return element_size == 1 || element_size == 2 || element_size == 4 ||
+			element_size == 8;
+}
+
+static void bench_sort(BenchCase *bench) {
+	size_t element_size = bench->element_size;
+	if (bench_keyed(element_size)) {
+		_array_sort(bench->array, ARRAY_KEY_UNSIGNED);
+	} else {
+		array_sort_custom(bench->array, bench_compare);
+	}
+	bench->bytes = bench->size * element_size;
+}
+
+// The middle element, what a median needs instead of a full sort
+static void bench_nth_element(BenchCase *bench) {
+	if (bench_keyed(bench->element_size)) {
+		_array_nth_element(bench->array, ARRAY_KEY_UNSIGNED, bench->size / 2);
+	} else {
+		array_nth_element_custom(bench->array, bench_compare, bench->size / 2);
+	}
+	bench->bytes = bench->size * bench->element_size;
+}
+
+// Top 100 in one pass, the array itself isn't touched
+static void bench_top_k(BenchCase *bench) {
+	Array *top = _array_new(bench->element_size);
+	if (bench_keyed(bench->element_size)) {
+		_array_top_k(bench->array, ARRAY_KEY_UNSIGNED, 100, top);
+	} else {
+		array_top_k_custom(bench->array, bench_compare, 100, top);
+	}
+	bench->sink += array_size(top);
+	bench->bytes = array_size(top) * bench->element_size;
+	array_free(top);
+}
+
+static void bench_duplicate(BenchCase *bench) {
+	Array *duplicate = array_duplicate(bench->array);
+	bench->bytes = bench->size * bench->element_size;
+	array_free(duplicate);
+}
+
+// Shares the buffer, nothing gets copied until someone writes
+static void bench_duplicate_cow(BenchCase *bench) {
+	array_set_copy_on_write(bench->array, true);
+	Array *duplicate = array_duplicate(bench->array);
+	bench->sink += array_size(duplicate);
+	array_free(duplicate);
+}
+
+static void bench_reverse(BenchCase *bench) {
+	array_reverse(bench->array);
+	bench->bytes = 2 * bench->size * bench->element_size;
+}
+
+static void bench_resize(BenchCase *bench) {
+	array_resize(bench->array, bench->size);
+	bench->bytes = bench->size * bench->element_size;
+}
+
+typedef struct BenchPusher {
+	BenchCase *bench;
+	ArrayConcurrent *concurrent;
+	pthread_mutex_t *mutex;
+	size_t count;
+} BenchPusher;
+
+static void *bench_concurrent_pusher(void *context) {
+	BenchPusher *pusher = context;
+	for (size_t i = 0; i < pusher->count; i++) {
+		array_concurrent_push(pusher->concurrent, pusher->bench->element);
+	}
+	return NULL;
+}
+
+// What ingestion threads do today, one Array behind one lock
+static void *bench_mutex_pusher(void *context) {
+	BenchPusher *pusher = context;
+	for (size_t i = 0; i < pusher->count; i++) {
+		pthread_mutex_lock(pusher->mutex);
+		array_push_back(pusher->bench->array, pusher->bench->element);
+		pthread_mutex_unlock(pusher->mutex);
+	}
+	return NULL;
+}
+
+// Splits size pushes over bench_threads threads
+static void bench_threaded_push(BenchCase *bench, void *(*push)(void *)) {
+	ArrayConcurrent *concurrent = _array_concurrent_new(bench->element_size);
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_t *threads = malloc(bench_threads * sizeof(pthread_t));
+	BenchPusher *pushers = malloc(bench_threads * sizeof(BenchPusher));
+	for (size_t i = 0; i < bench_threads; i++) {
+		size_t count = bench->size / bench_threads +
+				(i < bench->size % bench_threads);
+		pushers[i] = (BenchPusher){ bench, concurrent, &mutex, count };
+		pthread_create(&threads[i], NULL, push, &pushers[i]);
+	}
+	for (size_t i = 0; i < bench_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	bench->bytes = bench->size * bench->element_size;
+	free(threads);
+	free(pushers);
+	array_concurrent_free(concurrent);
+}
+
+static void bench_concurrent_push(BenchCase *bench) {
+	bench_threaded_push(bench, bench_concurrent_pusher);
+}
+
+static void bench_mutex_push(BenchCase *bench) {
+	bench_threaded_push(bench, bench_mutex_pusher);
+}
+
+static bool bench_threaded(const Benchmark *benchmark) {
+	return benchmark->run == bench_concurrent_push ||
+			benchmark->run == bench_mutex_push;
+}
+
+static const Benchmark benchmarks[] = {
+	{ "push_back", false, false, false, false, false, bench_push_back },
+	{ "push_back_huge", false, false, false, false, false, bench_push_back_huge },
+	{ "push_back_segmented", false, false, false, false, false, bench_push_back_segmented },
+	{ "push_front", true, false, true, false, false, bench_push_front },
+	{ "push_front_deque", false, true, false, false, false, bench_push_front_deque },
+	{ "pop_back", true, false, false, false, false, bench_pop_back },
+	{ "pop_front", true, false, true, false, false, bench_pop_front },
+	{ "pop_front_deque", true, true, false, false, false, bench_pop_front_deque },
+	{ "pop_front_into", true, false, false, false, true, bench_pop_front_into },
+	{ "at", true, false, false, true, false, bench_at },
+	{ "at_deque", true, true, false, true, false, bench_at },
+	{ "set", true, false, false, true, false, bench_set },
+	{ "insert_at", true, false, true, true, false, bench_insert_at },
+	{ "remove_at", true, false, true, true, false, bench_remove_at },
+	{ "remove_if", true, false, false, false, true, bench_remove_if },
+	{ "push_back_n", false, false, false, false, true, bench_push_back_n },
+	{ "insert_range", true, false, false, false, true, bench_insert_range },
+	{ "remove_range", true, false, false, false, true, bench_remove_range },
+	{ "find", true, false, true, false, false, bench_find },
+	{ "count", true, false, true, false, false, bench_count },
+	{ "contains_indexed", true, false, false, true, false, bench_contains_indexed },
+	{ "map", true, false, false, false, true, bench_map_whole },
+	{ "map_par", true, false, false, false, true, bench_map_par },
+	{ "filter", true, false, false, false, true, bench_filter_whole },
+	{ "filter_par", true, false, false, false, true, bench_filter_par },
+	{ "reduce", true, false, false, false, true, bench_reduce_whole },
+	{ "reduce_par", true, false, false, false, true, bench_reduce_par },
+	{ "chained", true, false, false, false, true, bench_chained },
+	{ "iter_pipeline", true, false, false, false, true, bench_iter_pipeline },
+	{ "iter_pipeline_par", true, false, false, false, true, bench_iter_pipeline_par },
+	{ "sort", true, false, false, false, true, bench_sort },
+	{ "nth_element", true, false, false, false, true, bench_nth_element },
+	{ "top_k", true, false, false, false, true, bench_top_k },
+	{ "duplicate", true, false, false, false, true, bench_duplicate },
+	{ "duplicate_cow", true, false, false, false, true, bench_duplicate_cow },
+	{ "reverse", true, false, false, false, true, bench_reverse },
+	{ "resize", false, false, false, false, true, bench_resize },
+	{ "concurrent_push", false, false, false, false, true, bench_concurrent_push },
+	{ "mutex_push", false, false, false, false, true, bench_mutex_push },
+};
+
+typedef struct BenchResult {
+	const char *name;
+	size_t element_size;
+	size_t size;
+	const char *pattern;
+	size_t ops;
+	double ns_per_op;
+	double bytes_per_op;
+	long peak_rss_kb;
+} BenchResult;
+
+static BenchResult bench_run(const Benchmark *benchmark, size_t element_size,
+		size_t size, BenchPattern pattern) {
+	bench_element_size = element_size;
+
+	size_t ops = benchmark->whole ? 1 : size;
+	if (benchmark->linear) {
+		ops = ops < BENCH_LINEAR_OPS ? ops : BENCH_LINEAR_OPS;
+	} else if (benchmark->filled && !benchmark->whole &&
+			benchmark->run != bench_pop_back &&
+			benchmark->run != bench_pop_front_deque) {
+		// Lookups don't use up the array, so they can run as long as needed
+		ops = ops > BENCH_MIN_OPS ? ops : BENCH_MIN_OPS;
+	}
+	size_t per_round = benchmark->whole ? size : ops;
+	size_t rounds = (BENCH_MIN_OPS + per_round - 1) / per_round;
+	if (benchmark->linear) {
+		rounds = 1;
+	}
+
+	size_t *indices = malloc(ops * sizeof(size_t));
+	unsigned char *element = malloc(element_size);
+	for (size_t i = 0; i < ops; i++) {
+		indices[i] = pattern == BENCH_RANDOM ? bench_random() % size : i % size;
+	}
+
+	double elapsed = 0.0;
+	double bytes = 0.0;
+	size_t sink = 0;
+	for (size_t round = 0; round < rounds; round++) {
+		Array *array = _array_new(element_size);
+		array_set_deque(array, benchmark->deque);
+		array_set_huge_pages(array, benchmark->run == bench_push_back_huge);
+		if (benchmark->filled) {
+			unsigned char *elements = malloc(size * element_size);
+			for (size_t i = 0; i < size; i++) {
+				bench_element(elements + i * element_size, element_size,
+						benchmark->run == bench_sort ? bench_random() : i);
+			}
+			array_push_back_n(array, elements, size);
+			free(elements);
+		}
+		bench_element(element, element_size, size / 2);
+
+		BenchCase bench = { array, size, element_size, ops, indices, element, 0, 0, 0.0 };
+		double start = bench_now();
+		benchmark->run(&bench);
+		double time = bench_now() - start;
+		if (bench.timed > 0.0) {
+			time = bench.timed;
+		}
+		elapsed += time;
+		bytes += bench.bytes;
+		sink += bench.sink;
+		array_free(array);
+	}
+
+	free(indices);
+	free(element);
+
+	// Keeps the compiler from dropping reads nobody looks at
+	if (sink == 1) {
+		fprintf(stderr, " ");
+	}
+
+	// Threaded runs put the thread count where the pattern would go
+	static char threads[32];
+	const char *label = "-";
+	if (benchmark->indexed) {
+		label = pattern == BENCH_RANDOM ? "random" : "sequential";
+	} else if (bench_threaded(benchmark)) {
+		snprintf(threads, sizeof(threads), "%zu thread%s", bench_threads,
+				bench_threads == 1 ? "" : "s");
+		label = threads;
+	}
+
+	size_t total = rounds * per_round;
+	return (BenchResult){ benchmark->name, element_size, size, label, total,
+		elapsed / total, bytes / total, bench_peak_rss_kb() };
+}
+
+static void bench_print(BenchResult *result, BenchFormat format, bool first) {
+	switch (format) {
+		case BENCH_TABLE:
+			if (first) {
+				printf("%-20s %6s %11s %10s %10s %12s %12s %12s\n", "benchmark",
+						"elem", "size", "pattern", "ops", "ns/op", "moved/op",
+						"peak_rss_kb");
+			}
+			printf("%-20s %6zu %11zu %10s %10zu %12.2f %12.1f %12ld\n",
+					result->name, result->element_size, result->size,
+					result->pattern, result->ops, result->ns_per_op,
+					result->bytes_per_op, result->peak_rss_kb);
+			break;
+		case BENCH_CSV:
+			if (first) {
+				printf("benchmark,element_size,size,pattern,ops,ns_per_op,bytes_moved_per_op,peak_rss_kb\n");
+			}
+			printf("%s,%zu,%zu,%s,%zu,%.3f,%.1f,%ld\n", result->name,
+					result->element_size, result->size, result->pattern,
+					result->ops, result->ns_per_op, result->bytes_per_op,
+					result->peak_rss_kb);
+			break;
+		case BENCH_JSON:
+			printf("%s\n\t\t{ \"benchmark\": \"%s\", \"element_size\": %zu, "
+				   "\"size\": %zu, \"pattern\": \"%s\", \"ops\": %zu, "
+				   "\"ns_per_op\": %.3f, \"bytes_moved_per_op\": %.1f, "
+				   "\"peak_rss_kb\": %ld }",
+					first ? "{\n\t\"results\": [" : ",", result->name,
+					result->element_size, result->size, result->pattern,
+					result->ops, result->ns_per_op, result->bytes_per_op,
+					result->peak_rss_kb);
+			break;
+	}
+	fflush(stdout);
+}
+
+static size_t bench_parse_list(const char *text, size_t *list) {
+	size_t count = 0;
+	while (*text && count < BENCH_MAX_LIST) {
+		char *end;
+		list[count++] = (size_t)strtod(text, &end); // strtod takes 1e8 too
+		text = *end == ',' ? end + 1 : end;
+		if (end == text && *text) {
+			break;
+		}
+	}
+	return count;
+}
+
+static void bench_usage(const char *program) {
+	printf("usage: %s [--format table|csv|json] [--sizes 8,1000,...] "
+		   "[--element-sizes 1,4,...] [--filter name]\n",
+			program);
+	printf("sizes go up to 1e8, big element sizes need a lot of memory there\n");
+}
+
+int main(int argc, char **argv) {
+	BenchFormat format = BENCH_TABLE;
+	size_t sizes[BENCH_MAX_LIST] = { 8, 1000, 100000, 1000000 };
+	size_t size_count = 4;
+	size_t element_sizes[BENCH_MAX_LIST] = { 1, 4, 8, 16, 64 };
+	size_t element_size_count = 5;
+	const char *filter = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--format") == 0 && has_value) {
+			const char *value = argv[++i];
+			format = strcmp(value, "csv") == 0	  ? BENCH_CSV
+					: strcmp(value, "json") == 0 ? BENCH_JSON
+												 : BENCH_TABLE;
+		} else if (strcmp(argv[i], "--sizes") == 0 && has_value) {
+			size_count = bench_parse_list(argv[++i], sizes);
+		} else if (strcmp(argv[i], "--element-sizes") == 0 && has_value) {
+			element_size_count = bench_parse_list(argv[++i], element_sizes);
+		} else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+			filter = argv[++i];
+		} else {
+			bench_usage(argv[0]);
+			return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+	}
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_threads = cores > 0 ? (size_t)cores : 1;
+
+	bool first = true;
+	size_t benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	for (size_t b = 0; b < benchmark_count; b++) {
+		const Benchmark *benchmark = &benchmarks[b];
+		if (filter && !strstr(benchmark->name, filter)) {
+			continue;
+		}
+		for (size_t e = 0; e < element_size_count; e++) {
+			for (size_t s = 0; s < size_count; s++) {
+				if (!element_sizes[e] || !sizes[s]) {
+					continue;
+				}
+				int patterns = benchmark->indexed ? 2 : 1;
+				for (int p = 0; p < patterns; p++) {
+					BenchResult result = bench_run(benchmark, element_sizes[e],
+							sizes[s], p ? BENCH_RANDOM : BENCH_SEQUENTIAL);
+					bench_print(&result, format, first);
+					first = false;
+				}
+				// Scaling from one thread up
+				for (bench_threads = 2; bench_threaded(benchmark) &&
+						bench_threads <= max_threads; bench_threads *= 2) {
+					BenchResult result = bench_run(benchmark, element_sizes[e],
+							sizes[s], BENCH_SEQUENTIAL);
+					bench_print(&result, format, first);
+				}
+				bench_threads = 1;
+			}
+		}
+	}
+
+	if (format == BENCH_JSON) {
+		printf(first ? "{ \"results\": [] }\n" : "\n\t]\n}\n");
+	}
+	array_parallel_shutdown();
+	return 0;
+}
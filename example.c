@@ -7,6 +7,8 @@ typedef struct Point {
 	float z;
 } Point;
 
+ARRAY_DEFINE(PointArray, Point)
+
 void point_to_string(char *buffer, Point *point) {
 	snprintf(buffer, ELEMENT_STRING_BUFFER_SIZE, "Point {x: %f, y: %f, z: %f}", point->x, point->y, point->z);
 }
@@ -28,5 +30,33 @@ int main(int argc, char **argv) {
 
     printf("Index of Point {x: 4.0, y: 4.0, z: 4.0}: %d\n", i);
 
+	// Typed handle over the same array, loops over data can be vectorized
+	PointArray typed = PointArray_wrap(points);
+	Point *data = PointArray_data(typed);
+	float sum_x = 0.0f;
+	for (size_t j = 0; j < PointArray_size(typed); j++) {
+		sum_x += data[j].x;
+	}
+
+	printf("Sum of x: %.2f\n", sum_x);
+
+	// Same points stored by field, a loop over x only touches x values
+	ArrayField fields[] = { ARRAY_FIELD(Point, x), ARRAY_FIELD(Point, y), ARRAY_FIELD(Point, z) };
+	ArraySoA *columns = array_soa_new(Point, fields, 3);
+	for (size_t j = 0; j < array_size(points); j++) {
+		array_soa_push_back(columns, _array_at(points, j));
+	}
+
+	float *xs = array_soa_column(columns, 0);
+	float soa_sum_x = 0.0f;
+	for (size_t j = 0; j < array_soa_size(columns); j++) {
+		soa_sum_x += xs[j];
+	}
+
+	printf("Sum of x (struct of arrays): %.2f\n", soa_sum_x);
+
+	array_soa_free(columns);
+	array_free(points);
+
 	return 0;
 }
\ No newline at end of file
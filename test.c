@@ -1,10 +1,87 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "array.h"
 
+ARRAY_DEFINE(IntArray, int)
+
+typedef struct Vec2 {
+	float x;
+	float y;
+} Vec2;
+
+ARRAY_DEFINE(Vec2Array, Vec2)
+
+typedef struct Particle {
+	char tag;
+	double mass;
+	int id;
+} Particle;
+
+int int_negate(int element) {
+	return -element;
+}
+
+int qsort_int(const void *a, const void *b) {
+	return (*(int *)a > *(int *)b) - (*(int *)a < *(int *)b);
+}
+
+int string_compare_reversed(char **a, char **b) {
+	return strcmp(*b, *a);
+}
+
+static int freed_count = 0;
+
+void int_count_free(int *element) {
+	freed_count++;
+}
+
+bool int_under_ten(int *element) {
+	return *element < 10;
+}
+
+void int_to_double_half(int *element, double *result) {
+	*result = *element / 2.0;
+}
+
+bool double_over_ten(double *element) {
+	return *element > 10.0;
+}
+
+void double_summation(double *element, double *accumulator) {
+	*accumulator += *element;
+}
+
+// Calls a _par function from inside one, which has to run inline
+static Array *nested_source;
+
+void int_plus_nested_sum(int *element, int *result) {
+	int sum = 0;
+	array_reduce_par(nested_source, int_summation, int_summation, &sum, &(int){ 0 });
+	*result = *element + sum;
+}
+
+typedef struct Pusher {
+	ArrayConcurrent *array;
+	int thread;
+} Pusher;
+
+// Pushes its thread number times a million plus a count, in pairs
+void *concurrent_pusher(void *context) {
+	ArrayConcurrent *array = ((Pusher *)context)->array;
+	int thread = ((Pusher *)context)->thread;
+	for (int i = 0; i < 20000; i += 2) {
+		int pair[2] = { thread * 1000000 + i, thread * 1000000 + i + 1 };
+		size_t index = array_concurrent_push_n(array, pair, 2);
+		assert(array_concurrent_at(array, int, index + 1) == pair[1]);
+	}
+	return NULL;
+}
+
 int main(int argc, char **argv) {
 	Array *a, *b;
 	// array_new
@@ -29,6 +106,24 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_with_capacity
+	a = array_with_capacity(int, 1000);
+
+	assert(array_size(a) == 0);
+	assert(array_capacity(a) > 1000);
+
+	size_t reserved = array_capacity(a);
+	for (size_t i = 0; i < 1000; i++) {
+		array_push_back(a, &i);
+	}
+	assert(array_capacity(a) == reserved);
+	for (size_t i = 0; i < 1000; i++) {
+		_array_pop_back(a);
+	}
+	assert(array_capacity(a) == reserved);
+
+	array_free(a);
+
 	// array_set_element_free
 	a = array_new(char *);
 
@@ -71,7 +166,7 @@ int main(int argc, char **argv) {
 	array_at(a, char *, 0) = hello;
 	array_at(a, char *, 1) = world;
 
-	array_duplicate_custom(a, string_duplicate);
+	b = array_duplicate_custom(a, string_duplicate);
 
 	assert(strcmp(array_at(a, char *, 0), array_at(b, char *, 0)) == 0);
 	assert(strcmp(array_at(a, char *, 1), array_at(b, char *, 1)) == 0);
@@ -82,6 +177,82 @@ int main(int argc, char **argv) {
 	array_free(a);
 	array_free(b);
 
+	// array_duplicate with copy-on-write
+	a = array_new(int);
+	for (int i = 0; i < 1000; i++) {
+		array_push_back(a, &i);
+	}
+	array_set_copy_on_write(a, true);
+	assert(!array_is_shared(a));
+
+	b = array_duplicate(a);
+	Array *c = array_duplicate(b);
+	assert(array_is_shared(a) && array_is_shared(b) && array_is_shared(c));
+	assert(_array_at(a, 0) == _array_at(b, 0));
+	assert(_array_at(b, 0) == _array_at(c, 0));
+	assert(array_size(c) == 1000 && array_at(c, int, 999) == 999);
+
+	// First change copies, the others keep the old data
+	array_set(b, 0, &(int){ -1 });
+	assert(!array_is_shared(b));
+	assert(array_at(b, int, 0) == -1 && array_at(a, int, 0) == 0);
+	assert(array_at(b, int, 500) == 500);
+	assert(array_is_shared(a) && array_is_shared(c));
+
+	array_push_back(a, &(int){ 1000 });
+	assert(array_size(a) == 1001 && array_size(c) == 1000);
+	assert(!array_is_shared(a) && !array_is_shared(c));
+
+	// Clearing a shared duplicate leaves the original alone
+	Array *d = array_duplicate(c);
+	array_clear(d);
+	assert(array_size(d) == 0 && array_size(c) == 1000);
+	assert(array_at(c, int, 999) == 999);
+	array_free(d);
+
+	d = array_duplicate(c);
+	assert(array_pop_back(d, int) == 999);
+	array_remove_at(d, 0);
+	int *written = array_data(c);
+	written[1] = -2;
+	assert(array_at(d, int, 0) == 1 && array_at(c, int, 1) == -2);
+	array_free(d);
+
+	array_free(c);
+	array_free(a);
+	array_free(b);
+
+	// Typed pushes copy too instead of writing into the shared data
+	IntArray shared = IntArray_new();
+	for (int i = 0; i < 100; i++) {
+		IntArray_push(shared, i);
+	}
+	array_set_copy_on_write(shared.array, true);
+	IntArray shared_copy = IntArray_wrap(array_duplicate(shared.array));
+	assert(array_is_shared(shared_copy.array));
+	IntArray_push(shared, 111);
+	IntArray_push(shared_copy, 222);
+	assert(*IntArray_at(shared, -1) == 111 && *IntArray_at(shared_copy, -1) == 222);
+	assert(*IntArray_at(shared, 99) == 99 && *IntArray_at(shared_copy, 99) == 99);
+	IntArray_free(shared);
+	IntArray_free(shared_copy);
+
+	// Shared elements get freed once, by the last one holding them
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+	for (int i = 0; i < 100; i++) {
+		char *string = malloc(8);
+		snprintf(string, 8, "%d", i);
+		array_push_back(a, &string);
+	}
+	array_set_copy_on_write(a, true);
+	b = array_duplicate(a);
+	assert(array_is_shared(b));
+	array_free(a);
+	assert(!array_is_shared(b));
+	assert(strcmp(array_at(b, char *, 42), "42") == 0);
+	array_free(b);
+
 	// array_size
 	a = array_new_with_size(int, 12);
 
@@ -117,6 +288,46 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_find/array_count with the element sizes that get vectorized
+	size_t element_sizes[] = { 1, 2, 3, 4, 8, 12, 16 };
+	for (size_t e = 0; e < 7; e++) {
+		size_t element_size = element_sizes[e];
+		unsigned char needle[16], element[16];
+		memset(needle, 0x5A, sizeof(needle));
+		needle[element_size - 1] = 0xA5;
+
+		a = _array_new(element_size);
+		array_set_deque(a, true);
+		size_t matches = 0;
+		for (size_t i = 0; i < 1200; i++) {
+			// Almost matching elements too, only one byte off
+			memcpy(element, needle, element_size);
+			element[i % element_size] ^= (i % 7 == 0 || i % 11 == 0) ? 0 : 1;
+			matches += memcmp(element, needle, element_size) == 0;
+			array_push_back(a, element);
+			// Wrap the deque around
+			if (i == 900) {
+				for (size_t j = 0; j < 300; j++) {
+					memcpy(element, _array_pop_front(a, false), element_size);
+					matches -= memcmp(element, needle, element_size) == 0;
+				}
+			}
+		}
+
+		assert(array_count(a, needle) == matches);
+		ptrdiff_t first = array_find(a, needle);
+		assert(first >= 0 && memcmp(_array_at(a, first), needle, element_size) == 0);
+		for (ptrdiff_t i = 0; i < first; i++) {
+			assert(memcmp(_array_at(a, i), needle, element_size) != 0);
+		}
+		needle[0] ^= 0xFF;
+		assert(array_find(a, needle) == -1);
+		assert(array_count(a, needle) == 0);
+		assert(array_contains(a, needle) == false);
+
+		array_free(a);
+	}
+
 	// array_find_custom
 	a = array_new(char *);
 	array_set_element_free(a, string_free);
@@ -286,6 +497,73 @@ int main(int argc, char **argv) {
 	assert(array_size(a) == 16);
 	assert(array_capacity(a) == 32);
 
+	// array_reserve
+	a = array_new(int);
+
+	array_reserve(a, 100);
+	assert(array_capacity(a) > 100);
+	assert(array_size(a) == 0);
+
+	array_reserve(a, 10);
+	assert(array_capacity(a) > 100);
+
+	// The reservation isn't part of the policy, and clearing gives it back
+	assert(array_growth_policy(a).min_capacity == MIN_CAPACITY);
+	array_clear(a);
+	assert(array_capacity(a) == MIN_CAPACITY);
+	for (size_t i = 0; i < 100; i++) {
+		array_push_back(a, &i);
+	}
+	for (size_t i = 0; i < 100; i++) {
+		_array_pop_back(a);
+	}
+	assert(array_capacity(a) < 100);
+
+	array_reserve(a, 100);
+	array_shrink_to_fit(a);
+	assert(array_capacity(a) == 1);
+	array_push_back_n(a, (int[100]){ 0 }, 100);
+	array_resize(a, 0);
+	assert(array_capacity(a) < 100);
+
+	array_free(a);
+
+	// array_set_growth_policy
+	a = array_new(int);
+
+	array_set_growth_policy(a, (ArrayGrowthPolicy){ 1.5, 4, 0.0 });
+	assert(array_growth_policy(a).growth_factor == 1.5);
+	assert(array_growth_policy(a).min_capacity == 4);
+
+	for (size_t i = 0; i < 64; i++) {
+		array_push_back(a, &i);
+	}
+	size_t grown = array_capacity(a);
+	assert(grown > 64 && grown < 128);
+
+	array_resize(a, 0);
+	assert(array_capacity(a) == grown); // Never shrinks
+
+	array_set_growth_policy(a, ARRAY_GROWTH_DEFAULT);
+	assert(array_capacity(a) < 16);
+
+	array_clear(a);
+	assert(array_capacity(a) == MIN_CAPACITY);
+
+	// Oscillating around a boundary doesn't realloc with hysteresis
+	for (size_t i = 0; i < 16; i++) {
+		array_push_back(a, &i);
+	}
+	assert(array_capacity(a) == 32);
+	for (size_t i = 0; i < 8; i++) {
+		_array_pop_back(a);
+		assert(array_capacity(a) == 32);
+		array_push_back(a, &i);
+		assert(array_capacity(a) == 32);
+	}
+
+	array_free(a);
+
 	// array_shrink_to_fit
 	a = array_new(int);
 
@@ -298,8 +576,18 @@ int main(int argc, char **argv) {
 
 	array_shrink_to_fit(a);
 
+	// One spare slot stays for pops to hand back
 	assert(array_size(a) == 23);
-	assert(array_capacity(a) == 23);
+	assert(array_capacity(a) == 24);
+
+	// Nothing past size gets read out of bounds
+	assert(array_pop_front(a, int) == 0);
+	assert(array_at(a, int, 0) == 1);
+	array_push_front(a, &(int){ 0 });
+
+	// Results don't go through the slot past size either
+	array_transform(a, int_squared);
+	assert(array_at(a, int, 0) == 0 && array_at(a, int, 22) == 484);
 
 	array_free(a);
 
@@ -382,6 +670,53 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_insert_range
+	a = array_new(int);
+
+	array_insert_range(a, 0, (int[]){ 1, 2, 3, 4 }, 4);
+	array_insert_range(a, 2, (int[]){ 7, 8 }, 2);
+	array_insert_range(a, array_size(a), (int[]){ 9 }, 1);
+	array_insert_range(a, -1, (int[]){ 5, 6 }, 2);
+	array_insert_range(a, 100, (int[]){ 0 }, 1); // Out of range, ignored
+
+	int inserted[] = { 1, 2, 7, 8, 3, 4, 5, 6, 9 };
+	assert(array_size(a) == 9);
+	for (size_t i = 0; i < 9; i++) {
+		assert(array_at(a, int, i) == inserted[i]);
+	}
+
+	// array_remove_range
+	// reusing a from previous
+	array_remove_range(a, 2, 4);
+	array_remove_range(a, -3, -1);
+	array_remove_range(a, 3, 1); // Empty range, ignored
+
+	int removed[] = { 1, 2, 3, 4, 9 };
+	assert(array_size(a) == 5);
+	for (size_t i = 0; i < 5; i++) {
+		assert(array_at(a, int, i) == removed[i]);
+	}
+
+	array_remove_range(a, 0, array_size(a));
+	assert(array_empty(a));
+
+	array_free(a);
+
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+
+	for (size_t i = 0; i < 8; i++) {
+		char *s = malloc(32);
+		snprintf(s, 32, "String %zu", i);
+		array_push_back(a, &s);
+	}
+	array_remove_range(a, 1, 7); // element_free on each, no leaks
+
+	assert(array_size(a) == 2);
+	assert(strcmp(array_at(a, char *, 1), "String 7") == 0);
+
+	array_free(a);
+
 	// array_remove
 	a = array_new(int);
 
@@ -416,6 +751,86 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_remove_all, every match goes and element_free runs once each
+	a = array_new(int);
+	for (int i = 0; i < 300; i++) {
+		array_push_back(a, &(int){ i % 3 });
+	}
+	array_set_element_free(a, int_count_free);
+	freed_count = 0;
+
+	array_remove_all(a, &(int){ 7 });
+	assert(array_size(a) == 300 && freed_count == 0);
+	array_remove_all(a, array_get(a, int, 1)); // Points into the array
+	assert(array_size(a) == 200 && freed_count == 100);
+	for (int i = 0; i < 200; i++) {
+		assert(array_at(a, int, i) == (i % 2) * 2);
+	}
+
+	// array_remove_all_custom through the index
+	array_enable_index(a, NULL, int_compare);
+	array_remove_all_custom(a, int_compare, &(int){ 0 });
+	assert(array_size(a) == 100 && freed_count == 200);
+	assert(array_find_custom(a, int_compare, &(int){ 2 }) == 0);
+	assert(!array_contains_custom(a, int_compare, &(int){ 0 }));
+	array_set_element_free(a, NULL);
+	array_free(a);
+
+	// No spare slot needed after shrink_to_fit
+	a = array_new(int);
+	for (int i = 0; i < 100; i++) {
+		array_push_back(a, &(int){ i % 4 });
+	}
+	array_shrink_to_fit(a);
+	array_remove_all(a, &(int){ 3 });
+	assert(array_size(a) == 75 && !array_contains(a, &(int){ 3 }));
+	array_free(a);
+
+	// array_remove_if
+	a = array_new(int);
+	array_set_deque(a, true);
+	for (int i = 0; i < 20; i++) {
+		array_push_front(a, &(int){ i });
+	}
+	array_set_element_free(a, int_count_free);
+	freed_count = 0;
+	array_remove_if(a, int_even);
+	assert(array_size(a) == 10 && freed_count == 10);
+	for (int i = 0; i < 10; i++) {
+		assert(array_at(a, int, i) == 19 - 2 * i);
+	}
+	array_set_element_free(a, NULL);
+	array_free(a);
+
+	// array_dedup_adjacent
+	a = array_new(int);
+	int runs[] = { 1, 1, 1, 2, 3, 3, 1, 1, 4 };
+	array_push_back_n(a, runs, 9);
+	array_set_element_free(a, int_count_free);
+	freed_count = 0;
+	array_dedup_adjacent(a);
+	assert(array_size(a) == 5 && freed_count == 4);
+	int deduped[] = { 1, 2, 3, 1, 4 };
+	assert(memcmp(array_data(a), deduped, sizeof(deduped)) == 0);
+	array_set_element_free(a, NULL);
+	array_free(a);
+
+	// array_dedup_adjacent_custom on sorted strings, duplicates get freed
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+	const char *words[] = { "b", "a", "c", "a", "b", "a" };
+	for (int i = 0; i < 6; i++) {
+		char *word = malloc(2);
+		strcpy(word, words[i]);
+		array_push_back(a, &word);
+	}
+	array_sort_custom(a, string_compare);
+	array_dedup_adjacent_custom(a, string_compare);
+	assert(array_size(a) == 3);
+	assert(strcmp(array_at(a, char *, 0), "a") == 0);
+	assert(strcmp(array_at(a, char *, 2), "c") == 0);
+	array_free(a);
+
 	// array_front
 	a = array_new(int);
 
@@ -457,6 +872,40 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_push_back_n
+	a = array_new(int);
+
+	int batch[1000];
+	for (size_t i = 0; i < 1000; i++) {
+		batch[i] = i;
+	}
+	array_push_back_n(a, batch, 1000);
+	array_push_back_n(a, batch, 10);
+
+	assert(array_size(a) == 1010);
+	assert(array_at(a, int, 999) == 999);
+	assert(array_at(a, int, -1) == 9);
+
+	array_free(a);
+
+	// array_append_array
+	a = array_new(int);
+	b = array_new(int);
+
+	array_push_back_n(a, (int[]){ 1, 2, 3 }, 3);
+	array_push_back_n(b, (int[]){ 4, 5 }, 2);
+	array_append_array(a, b);
+	array_append_array(a, a);
+
+	int appended[] = { 1, 2, 3, 4, 5, 1, 2, 3, 4, 5 };
+	assert(array_size(a) == 10);
+	for (size_t i = 0; i < 10; i++) {
+		assert(array_at(a, int, i) == appended[i]);
+	}
+
+	array_free(a);
+	array_free(b);
+
 	// array_push_front
 	a = array_new(int);
 
@@ -515,6 +964,127 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_pop_front_into, array_pop_back_into, array_drain
+	a = array_new(int);
+	for (int i = 0; i < 100; i++) {
+		array_push_back(a, &i);
+	}
+
+	int taken[100];
+	assert(array_pop_front_into(a, taken, 10) == 10);
+	assert(taken[0] == 0 && taken[9] == 9);
+	assert(array_size(a) == 90 && array_front(a, int) == 10);
+
+	assert(array_pop_back_into(a, taken, 5) == 5);
+	assert(taken[0] == 95 && taken[4] == 99);
+	assert(array_back(a, int) == 94);
+
+	// [20, 30) of what's left is 30 to 39
+	assert(array_drain(a, 20, 30, taken) == 10);
+	assert(taken[0] == 30 && taken[9] == 39);
+	assert(array_at(a, int, 20) == 40 && array_size(a) == 75);
+	assert(array_drain(a, -5, -1, taken) == 4);
+	assert(taken[0] == 90 && array_back(a, int) == 94);
+	assert(array_drain(a, 5, 5, taken) == 0);
+	assert(array_drain(a, 60, 1000, taken) == 0);
+
+	assert(array_pop_back_into(a, taken, 1000) == 71);
+	assert(taken[0] == 10 && taken[70] == 94);
+	assert(array_empty(a));
+	assert(array_pop_front_into(a, taken, 1) == 0);
+
+	// Wrapped deque, the batch comes out of both ends of the buffer
+	array_set_deque(a, true);
+	for (int i = 0; i < 40; i++) {
+		array_push_back(a, &i);
+		array_push_front(a, &(int){ -1 - i });
+	}
+	assert(array_pop_front_into(a, taken, 50) == 50);
+	assert(taken[0] == -40 && taken[39] == -1 && taken[40] == 0 && taken[49] == 9);
+	assert(array_front(a, int) == 10 && array_size(a) == 30);
+
+	array_free(a);
+
+	// Elements moved out aren't freed, out owns them now
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+	for (int i = 0; i < 4; i++) {
+		char *string = malloc(8);
+		snprintf(string, 8, "%d", i);
+		array_push_back(a, &string);
+	}
+	char *strings[2];
+	assert(array_drain(a, 1, 3, strings) == 2);
+	assert(strcmp(strings[0], "1") == 0 && strcmp(strings[1], "2") == 0);
+	free(strings[0]);
+	free(strings[1]);
+	array_free(a);
+
+	// array_set_deque
+	a = array_new(int);
+	array_set_deque(a, true);
+	assert(array_is_deque(a));
+
+	// FIFO that wraps around the ring many times
+	int next_in = 0, next_out = 0;
+	for (size_t i = 0; i < 1000; i++) {
+		array_push_back(a, &next_in);
+		next_in++;
+		if (i % 3 != 0) {
+			assert(array_pop_front(a, int) == next_out);
+			next_out++;
+		}
+	}
+	assert(array_size(a) == next_in - next_out);
+	assert(array_front(a, int) == next_out);
+	assert(array_back(a, int) == next_in - 1);
+	assert(array_at(a, int, -2) == next_in - 2);
+
+	while (!array_empty(a)) {
+		assert(array_pop_front(a, int) == next_out);
+		next_out++;
+	}
+	assert(array_capacity(a) == MIN_CAPACITY);
+
+	// Both ends, checked against a plain array doing the same thing
+	b = array_new(int);
+	for (int i = 0; i < 500; i++) {
+		switch (rand() % 5) {
+			case 0:
+				array_push_front(a, &i);
+				array_push_front(b, &i);
+				break;
+			case 1:
+			case 2:
+				array_push_back(a, &i);
+				array_push_back(b, &i);
+				break;
+			case 3:
+				if (!array_empty(b)) {
+					assert(array_pop_front(a, int) == array_pop_front(b, int));
+				}
+				break;
+			case 4:
+				if (!array_empty(b)) {
+					assert(array_pop_back(a, int) == array_pop_back(b, int));
+				}
+				break;
+		}
+	}
+	array_insert_at(a, 3, &(int){ -1 });
+	array_insert_at(b, 3, &(int){ -1 });
+	array_remove_at(a, -5);
+	array_remove_at(b, -5);
+
+	assert(array_size(a) == array_size(b));
+	for (size_t i = 0; i < array_size(a); i++) {
+		assert(array_at(a, int, i) == array_at(b, int, i));
+	}
+	assert(memcmp(array_data(a), array_data(b), array_size(a) * sizeof(int)) == 0);
+
+	array_free(a);
+	array_free(b);
+
 	// array_map
 	a = array_new(int);
 	for (size_t i = 0; i < 16; i++) {
@@ -543,6 +1113,83 @@ int main(int argc, char **argv) {
 	array_free(a);
 	array_free(b);
 
+	// array_retain
+	a = array_new(int);
+	for (size_t i = 0; i < 100; i++) {
+		array_push_back(a, &(int){ i });
+	}
+	array_set_element_free(a, int_count_free);
+	freed_count = 0;
+
+	array_retain(a, int_even);
+	assert(array_size(a) == 50);
+	assert(freed_count == 50);
+	for (size_t i = 0; i < 50; i++) {
+		assert(array_at(a, int, i) == 2 * i);
+	}
+	array_retain(a, int_under_ten);
+	assert(array_size(a) == 5);
+	assert(freed_count == 95);
+	assert(array_capacity(a) < 100);
+
+	array_set_element_free(a, NULL);
+	array_free(a);
+
+	// array_retain on a wrapped deque with an index
+	a = array_new(int);
+	array_set_deque(a, true);
+	for (int i = 0; i < 12; i++) {
+		array_push_front(a, &(int){ i });
+	}
+	array_enable_index(a, NULL, NULL);
+	array_retain(a, int_even);
+	assert(array_size(a) == 6);
+	for (int i = 0; i < 6; i++) {
+		assert(array_at(a, int, i) == 10 - 2 * i);
+		assert(array_find(a, &(int){ 10 - 2 * i }) == i);
+	}
+	assert(!array_contains(a, &(int){ 3 }));
+	array_free(a);
+
+	// array_transform
+	a = array_new(int);
+	array_set_deque(a, true);
+	for (int i = 0; i < 16; i++) {
+		array_push_front(a, &(int){ 15 - i });
+	}
+	array_enable_index(a, NULL, NULL);
+	array_transform(a, int_squared);
+	for (int i = 0; i < 16; i++) {
+		assert(array_at(a, int, i) == i * i);
+	}
+	assert(array_find(a, &(int){ 49 }) == 7);
+	assert(!array_contains(a, &(int){ 3 }));
+	array_free(a);
+
+	// array_transform_into, a reserved output never reallocates
+	a = array_new(int);
+	for (int i = 0; i < 64; i++) {
+		array_push_back(a, &(int){ i });
+	}
+	b = array_new(double);
+	array_reserve(b, 64);
+	void *reserved_data = array_data(b);
+	for (int frame = 0; frame < 3; frame++) {
+		array_transform_into(a, b, int_to_double_half);
+		assert(array_size(b) == 64);
+		assert(array_data(b) == reserved_data);
+		for (int i = 0; i < 64; i++) {
+			assert(array_at(b, double, i) == i / 2.0);
+		}
+	}
+	array_retain(a, int_even);
+	array_transform_into(a, b, int_to_double_half);
+	assert(array_size(b) == 32);
+	assert(array_at(b, double, 31) == 31.0);
+	assert(array_data(b) == reserved_data);
+	array_free(a);
+	array_free(b);
+
 	// array_reduce
 	a = array_new(int);
 	for (size_t i = 0; i < 16; i++) {
@@ -559,6 +1206,1023 @@ int main(int argc, char **argv) {
 
 	array_free(a);
 
+	// array_iter
+	a = array_new(int);
+	for (int i = 0; i < 100; i++) {
+		array_push_back(a, &(int){ i });
+	}
+
+	reduced = 0;
+	array_iter_reduce(array_iter_filter(array_iter_map(array_iter(a),
+							  int_squared),
+							  int_even),
+			int_summation, &reduced);
+	int expected = 0;
+	for (int i = 0; i < 100; i += 2) {
+		expected += i * i;
+	}
+	assert(reduced == expected);
+
+	// Stages apply in order, take stops the pass
+	ArrayIter iter = array_iter_take(array_iter_filter(array_iter(a), int_even), 5);
+	iter = array_iter_map(iter, int_squared);
+	assert(array_iter_count(iter) == 5);
+	b = array_iter_collect(iter);
+	assert(array_size(b) == 5);
+	for (int i = 0; i < 5; i++) {
+		assert(array_at(b, int, i) == 4 * i * i);
+	}
+	array_free(b);
+	assert(array_iter_count(array_iter_take(array_iter(a), 0)) == 0);
+	assert(array_iter_count(array_iter_take(array_iter(a), 1000)) == 100);
+
+	// Maps can change the element type
+	iter = array_iter_filter(array_iter_map_to(array_iter(a), double,
+									 int_to_double_half),
+			double_over_ten);
+	b = array_iter_collect(iter);
+	assert(array_element_size(b) == sizeof(double));
+	assert(array_size(b) == 79);
+	assert(array_at(b, double, 0) == 10.5);
+	array_free(b);
+	double half_sum = 0.0;
+	array_iter_reduce(iter, double_summation, &half_sum);
+	assert(half_sum == 2370.0);
+
+	// Too many stages and nothing runs
+	iter = array_iter(a);
+	for (int i = 0; i <= ARRAY_ITER_MAX_STAGES; i++) {
+		iter = array_iter_filter(iter, int_even);
+	}
+	assert(iter.array == NULL);
+	assert(array_iter_collect(iter) == NULL);
+	array_free(a);
+
+	// array_sort
+	// Radix sort for big arrays, introsort for small ones, same results
+	size_t sort_sizes[] = { 0, 1, 10, 63, 64, 5000 };
+	for (size_t n = 0; n < 6; n++) {
+		a = array_new(int);
+		for (size_t i = 0; i < sort_sizes[n]; i++) {
+			array_push_back(a, &(int){ rand() - RAND_MAX / 2 });
+		}
+		b = array_duplicate(a);
+
+		array_sort(a, int);
+		qsort(array_data(b), array_size(b), sizeof(int), qsort_int);
+		for (size_t i = 0; i < array_size(a); i++) {
+			assert(array_at(a, int, i) == array_at(b, int, i));
+		}
+
+		array_free(a);
+		array_free(b);
+	}
+
+	a = array_new(double);
+	for (size_t i = 0; i < 1000; i++) {
+		array_push_back(a, &(double){ (rand() % 2001 - 1000) / 7.0 });
+	}
+	array_push_back(a, &(double){ -0.5e300 });
+	array_push_back(a, &(double){ 1e300 });
+	array_sort(a, double);
+	for (size_t i = 1; i < array_size(a); i++) {
+		assert(array_at(a, double, i - 1) <= array_at(a, double, i));
+	}
+	assert(array_front(a, double) == -0.5e300);
+	assert(array_back(a, double) == 1e300);
+	array_free(a);
+
+	a = array_new(unsigned char);
+	for (size_t i = 0; i < 300; i++) {
+		array_push_back(a, &(unsigned char){ 255 - i % 256 });
+	}
+	array_sort(a, unsigned char);
+	for (size_t i = 1; i < array_size(a); i++) {
+		assert(array_at(a, unsigned char, i - 1) <= array_at(a, unsigned char, i));
+	}
+	array_free(a);
+
+	// Sorted, reversed and all equal runs are where quicksort goes bad
+	a = array_new(int);
+	for (size_t i = 0; i < 3000; i++) {
+		array_push_back(a, &(int){ i < 1000 ? i : i < 2000 ? 3000 - i : 7 });
+	}
+	array_sort_custom(a, int_compare);
+	for (size_t i = 1; i < array_size(a); i++) {
+		assert(array_at(a, int, i - 1) <= array_at(a, int, i));
+	}
+	array_free(a);
+
+	// array_sort_custom
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+	for (size_t i = 0; i < 100; i++) {
+		char *s = malloc(32);
+		snprintf(s, 32, "String %03zu", (i * 37) % 100);
+		array_push_back(a, &s);
+	}
+
+	array_sort_custom(a, string_compare);
+	assert(strcmp(array_front(a, char *), "String 000") == 0);
+	assert(strcmp(array_back(a, char *), "String 099") == 0);
+	array_sort_custom(a, string_compare_reversed);
+	assert(strcmp(array_front(a, char *), "String 099") == 0);
+
+	// array_bsearch_custom
+	// reusing a from previous
+	assert(array_bsearch_custom(a, string_compare_reversed, &(char *){ "String 042" }) == 57);
+	assert(array_bsearch_custom(a, string_compare_reversed, &(char *){ "Nope" }) == -1);
+
+	array_free(a);
+
+	// array_bsearch, array_lower_bound, array_upper_bound
+	a = array_new(int);
+	array_push_back_n(a, (int[]){ 9, 1, 5, 5, 5, -3, 7 }, 7);
+	array_sort(a, int);
+
+	assert(array_bsearch(a, int, &(int){ 7 }) == 5);
+	assert(array_bsearch(a, int, &(int){ -3 }) == 0);
+	assert(array_bsearch(a, int, &(int){ 6 }) == -1);
+	assert(array_lower_bound(a, int, &(int){ 5 }) == 2);
+	assert(array_upper_bound(a, int, &(int){ 5 }) == 5);
+	assert(array_lower_bound(a, int, &(int){ 100 }) == 7);
+	assert(array_upper_bound_custom(a, int_compare, &(int){ -10 }) == 0);
+
+	array_free(a);
+
+	// array_nth_element, array_partial_sort, array_top_k
+	a = array_new(int);
+	for (size_t i = 0; i < 5000; i++) {
+		array_push_back(a, &(int){ rand() - RAND_MAX / 2 });
+	}
+	// Plenty of duplicates and an already sorted run
+	for (size_t i = 0; i < 2000; i++) {
+		array_push_back(a, &(int){ i < 1000 ? 42 : (int)i });
+	}
+	b = array_duplicate(a);
+	qsort(array_data(b), array_size(b), sizeof(int), qsort_int);
+
+	size_t nths[] = { 0, 1, 17, 3500, 6999 };
+	for (size_t n = 0; n < 5; n++) {
+		int *nth = array_nth_element(a, int, nths[n]);
+		assert(*nth == array_at(b, int, nths[n]));
+		for (size_t i = 0; i < array_size(a); i++) {
+			assert(i < nths[n] ? array_at(a, int, i) <= *nth : array_at(a, int, i) >= *nth);
+		}
+	}
+	assert(*(int *)array_nth_element_custom(a, int_compare, -1) == array_back(b, int));
+	assert(array_nth_element(a, int, 7000) == NULL);
+
+	array_partial_sort(a, int, 100);
+	for (size_t i = 0; i < 100; i++) {
+		assert(array_at(a, int, i) == array_at(b, int, i));
+	}
+	array_partial_sort_custom(a, int_compare, 100000);
+	for (size_t i = 0; i < array_size(a); i++) {
+		assert(array_at(a, int, i) == array_at(b, int, i));
+	}
+
+	Array *top = array_new(int);
+	array_push_back(top, &(int){ 1 });
+	array_top_k(b, int, 100, top);
+	assert(array_size(top) == 100);
+	for (size_t i = 0; i < 100; i++) {
+		assert(array_at(top, int, i) == array_at(b, int, -1 - (ptrdiff_t)i));
+	}
+	// Asking for more than there are gives everything
+	array_top_k_custom(b, int_compare, 10000, top);
+	assert(array_size(top) == 7000);
+	assert(array_at(top, int, -1) == array_front(b, int));
+	array_top_k(b, int, 0, top);
+	assert(array_size(top) == 0);
+
+	// The k smallest, on the integer key path and with a comparator
+	array_bottom_k(b, int, 100, top);
+	assert(array_size(top) == 100);
+	for (size_t i = 0; i < 100; i++) {
+		assert(array_at(top, int, i) == array_at(b, int, i));
+	}
+	array_reverse(b);
+	array_bottom_k_custom(b, int_compare, 50, top);
+	assert(array_size(top) == 50);
+	assert(array_at(top, int, 0) == array_back(b, int));
+	assert(array_at(top, int, 49) == array_at(b, int, -50));
+	array_free(top);
+
+	array_free(a);
+	array_free(b);
+
+	// Comparator flipped for the smallest strings
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+	for (size_t i = 0; i < 100; i++) {
+		char *s = malloc(32);
+		snprintf(s, 32, "String %03zu", (i * 37) % 100);
+		array_push_back(a, &s);
+	}
+	b = array_new(char *);
+	array_top_k_custom(a, string_compare_reversed, 3, b);
+	assert(strcmp(array_at(b, char *, 0), "String 000") == 0);
+	assert(strcmp(array_at(b, char *, 2), "String 002") == 0);
+	array_bottom_k_custom(a, string_compare, 3, b);
+	assert(strcmp(array_at(b, char *, 2), "String 002") == 0);
+	array_free(b);
+	array_free(a);
+
+	// array_set_keep_sorted, array_insert_sorted
+	a = array_new(int);
+	array_push_back_n(a, (int[]){ 4, 8, 2 }, 3);
+	array_set_keep_sorted(a, int_compare);
+	assert(array_keep_sorted(a) == int_compare);
+	assert(array_at(a, int, 0) == 2);
+
+	for (int i = 0; i < 200; i++) {
+		array_insert_sorted(a, &(int){ (i * 7919) % 101 });
+	}
+	for (size_t i = 1; i < array_size(a); i++) {
+		assert(array_at(a, int, i - 1) <= array_at(a, int, i));
+	}
+	// Binary searched now
+	assert(array_find_custom(a, int_compare, &(int){ 4 }) == array_lower_bound(a, int, &(int){ 4 }));
+	assert(array_count_custom(a, int_compare, &(int){ 4 }) == 3);
+	assert(array_contains_custom(a, int_compare, &(int){ 1000 }) == false);
+
+	array_set_keep_sorted(a, NULL);
+	assert(array_keep_sorted(a) == NULL);
+
+	// Anything but array_insert_sorted drops the order
+	array_set_keep_sorted(a, int_compare);
+	array_push_back(a, &(int){ -5 });
+	assert(array_keep_sorted(a) == NULL);
+	assert(array_find_custom(a, int_compare, &(int){ -5 }) == (ptrdiff_t)array_size(a) - 1);
+	assert(array_count_custom(a, int_compare, &(int){ -5 }) == 1);
+
+	array_set_keep_sorted(a, int_compare);
+	array_reverse(a);
+	assert(array_keep_sorted(a) == NULL);
+	array_set_keep_sorted(a, int_compare);
+	array_set(a, 0, &(int){ 1000 });
+	assert(array_keep_sorted(a) == NULL);
+	assert(array_contains_custom(a, int_compare, &(int){ 1000 }));
+
+	array_free(a);
+
+	IntArray sorted = IntArray_new();
+	IntArray_push(sorted, 3);
+	array_set_keep_sorted(sorted.array, int_compare);
+	IntArray_push(sorted, 1);
+	assert(array_keep_sorted(sorted.array) == NULL);
+	assert(array_count_custom(sorted.array, int_compare, &(int){ 1 }) == 1);
+	IntArray_free(sorted);
+
+	// array_enable_index
+	a = array_new(int);
+	b = array_new(int);
+	array_push_back_n(a, (int[]){ 3, 1, 4, 1, 5 }, 5);
+	assert(array_enable_index(a, NULL, NULL));
+	assert(array_has_index(a));
+	assert(array_find(a, &(int){ 1 }) == 1);
+	assert(array_count(a, &(int){ 1 }) == 2);
+
+	// Every kind of change, checked against a plain array doing the same
+	array_push_back_n(b, (int[]){ 3, 1, 4, 1, 5 }, 5);
+	for (int i = 0; i < 3000; i++) {
+		int v = rand() % 50;
+		size_t at = array_size(b) ? rand() % array_size(b) : 0;
+		switch (rand() % 10) {
+			case 0:
+				array_push_front(a, &v);
+				array_push_front(b, &v);
+				break;
+			case 1:
+			case 2:
+				array_push_back(a, &v);
+				array_push_back(b, &v);
+				break;
+			case 3:
+				array_insert_range(a, at, (int[]){ v, v + 1, v }, 3);
+				array_insert_range(b, at, (int[]){ v, v + 1, v }, 3);
+				break;
+			case 4:
+				array_remove_range(a, at, at + 2 < array_size(b) ? at + 2 : array_size(b));
+				array_remove_range(b, at, at + 2 < array_size(b) ? at + 2 : array_size(b));
+				break;
+			case 5:
+				if (array_size(b)) {
+					array_set(a, at, &v);
+					array_set(b, at, &v);
+				}
+				break;
+			case 6:
+				if (array_size(b)) {
+					assert(array_pop_front(a, int) == array_pop_front(b, int));
+				}
+				break;
+			case 7:
+				if (array_size(b)) {
+					assert(array_pop_back(a, int) == array_pop_back(b, int));
+				}
+				break;
+			case 8:
+				if (array_size(b) > 2) {
+					assert(array_pop_at(a, int, at) == array_pop_at(b, int, at));
+				}
+				break;
+			case 9:
+				array_set_deque(a, rand() % 2);
+				break;
+		}
+
+		int needle = rand() % 52;
+		assert(array_find(a, &needle) == array_find_custom(b, int_compare, &needle));
+		assert(array_count(a, &needle) == array_count_custom(b, int_compare, &needle));
+	}
+
+	array_sort(a, int);
+	array_sort(b, int);
+	assert(array_find(a, &(int){ 7 }) == array_find_custom(b, int_compare, &(int){ 7 }));
+	array_resize(a, 10);
+	array_resize(b, 10);
+	assert(array_count(a, &(int){ 7 }) == array_count_custom(b, int_compare, &(int){ 7 }));
+	array_clear(a);
+	assert(array_find(a, &(int){ 7 }) == -1);
+
+	// Removing something written behind the index's back rebuilds it
+	array_push_back_n(a, (int[]){ 1, 2, 3, 4 }, 4);
+	array_at(a, int, 1) = 20;
+	array_remove_at(a, 1);
+	assert(array_find(a, &(int){ 3 }) == 1);
+	assert(array_find(a, &(int){ 4 }) == 2);
+	assert(array_count(a, &(int){ 2 }) == 0);
+
+	array_disable_index(a);
+	assert(!array_has_index(a));
+
+	array_free(a);
+	array_free(b);
+
+	a = array_new(char *);
+	array_set_element_free(a, string_free);
+	array_enable_index(a, string_hash, string_compare);
+	for (size_t i = 0; i < 1000; i++) {
+		char *s = malloc(32);
+		snprintf(s, 32, "String %zu", i % 500);
+		array_push_back(a, &s);
+	}
+	assert(array_find_custom(a, string_compare, &(char *){ "String 123" }) == 123);
+	assert(array_count_custom(a, string_compare, &(char *){ "String 123" }) == 2);
+	assert(array_contains_custom(a, string_compare, &(char *){ "String 500" }) == false);
+	array_remove_custom(a, string_compare, &(char *){ "String 0" });
+	assert(array_find_custom(a, string_compare, &(char *){ "String 0" }) == 499);
+
+	array_free(a);
+
+	// array_map_par, array_filter_par, array_reduce_par
+	array_set_parallel_threads(4);
+	array_set_parallel_threshold(1000);
+
+	a = array_new(int);
+	for (size_t i = 0; i < 100000; i++) {
+		array_push_back(a, &(int){ i % 1000 });
+	}
+
+	b = array_map_par(a, int_squared);
+	assert(array_size(b) == 100000);
+	for (size_t i = 0; i < 100000; i++) {
+		assert(array_at(b, int, i) == (i % 1000) * (i % 1000));
+	}
+	array_free(b);
+
+	b = array_filter_par(a, int_even);
+	assert(array_size(b) == 50000);
+	for (size_t i = 0; i < 50000; i++) {
+		assert(array_at(b, int, i) == (2 * i) % 1000);
+	}
+	array_free(b);
+
+	reduced = 7;
+	array_reduce_par(a, int_summation, int_summation, &reduced, &(int){ 0 });
+	assert(reduced == 7 + 100 * 499500);
+
+	// Fused pipelines in chunks, same results and order as the serial pass
+	iter = array_iter_filter(array_iter_map(array_iter(a), int_squared), int_even);
+	b = array_iter_collect_par(iter);
+	assert(array_size(b) == 50000);
+	for (size_t i = 0; i < 50000; i++) {
+		assert(array_at(b, int, i) == ((2 * i) % 1000) * ((2 * i) % 1000));
+	}
+	array_free(b);
+
+	reduced = 0;
+	iter = array_iter_filter(array_iter(a), int_even);
+	array_iter_reduce_par(iter, int_summation, int_summation, &reduced, &(int){ 0 });
+	int serial = 0;
+	array_iter_reduce(iter, int_summation, &serial);
+	assert(reduced == serial && reduced == 100 * 249500);
+
+	// A take keeps it on one thread and in order
+	b = array_iter_collect_par(array_iter_take(iter, 3));
+	assert(array_size(b) == 3 && array_at(b, int, 2) == 4);
+	array_free(b);
+
+	// _par calls from inside a callback don't wait on the pool they're in
+	nested_source = array_new(int);
+	for (int i = 0; i < 2000; i++) {
+		array_push_back(nested_source, &(int){ 1 });
+	}
+	array_resize(a, 4000);
+	b = array_map_par(a, int_plus_nested_sum);
+	assert(array_size(b) == 4000 && array_at(b, int, 1234) == 234 + 2000);
+	array_free(b);
+	array_free(nested_source);
+
+	// Below the threshold falls back to the serial versions
+	array_resize(a, 10);
+	b = array_map_par(a, int_squared);
+	assert(array_size(b) == 10 && array_at(b, int, 9) == 81);
+	array_free(b);
+
+	array_free(a);
+	array_parallel_shutdown();
+	array_set_parallel_threads(0);
+	array_set_parallel_threshold(ARRAY_PARALLEL_THRESHOLD);
+
+	// array_open_mapped
+	const char *path = "arraytest_mapped.bin";
+	remove(path);
+	assert(array_open_mapped(path, sizeof(int), 0) == NULL);
+
+	a = array_open_mapped(path, sizeof(int), ARRAY_MAP_CREATE);
+	assert(a && array_is_mapped(a) && array_empty(a));
+	// The rest of the first page is capacity too
+	assert(array_capacity(a) > MIN_CAPACITY);
+	for (int i = 0; i < 100000; i++) {
+		array_push_back(a, &i);
+	}
+	array_remove_range(a, 0, 10);
+	assert(array_sync(a));
+	array_free(a);
+
+	// Several readers can map it at once
+	a = array_open_mapped(path, sizeof(int), ARRAY_MAP_READ_ONLY);
+	b = array_open_mapped(path, sizeof(int), ARRAY_MAP_READ_ONLY);
+	assert(array_size(a) == 99990 && array_size(b) == 99990);
+	assert(array_at(a, int, 0) == 10 && array_at(b, int, -1) == 99999);
+	assert(array_find(a, &(int){ 500 }) == 490);
+	array_free(a);
+	array_free(b);
+
+	assert(array_open_mapped(path, sizeof(double), 0) == NULL);
+
+	// Deque wraparound gets straightened out before the file is written
+	a = array_open_mapped(path, sizeof(int), 0);
+	array_set_deque(a, true);
+	for (int i = 0; i < 20; i++) {
+		_array_pop_back(a);
+		array_push_front(a, &(int){ -i });
+	}
+	array_free(a);
+
+	a = array_open_mapped(path, sizeof(int), 0);
+	assert(array_size(a) == 99990);
+	assert(array_at(a, int, 0) == -19 && array_at(a, int, 20) == 10);
+	assert(array_at(a, int, -1) == 99979);
+	array_clear(a);
+	array_free(a);
+	remove(path);
+
+	// array_save, array_load
+	path = "arraytest_saved.bin";
+	a = array_new(int);
+	array_set_deque(a, true);
+	for (int i = 0; i < 1000; i++) {
+		array_push_back(a, &i);
+		array_push_front(a, &(int){ -i });
+	}
+	assert(array_save(a, path, ARRAY_SAVE_CHECKSUM));
+
+	b = array_load(path, sizeof(int));
+	assert(array_size(b) == 2000);
+	for (int i = 0; i < 2000; i++) {
+		assert(array_at(b, int, i) == array_at(a, int, i));
+	}
+	array_free(b);
+	assert(array_load(path, sizeof(char)) == NULL);
+
+	// Flipped bits fail the checksum
+	FILE *file = fopen(path, "r+b");
+	fseek(file, -5, SEEK_END);
+	fputc(0x55, file);
+	fclose(file);
+	assert(array_load(path, sizeof(int)) == NULL);
+
+	// A count bigger than the file is rejected before allocating anything
+	assert(array_save(a, path, 0));
+	file = fopen(path, "r+b");
+	fseek(file, 24, SEEK_SET);
+	fwrite(&(uint64_t){ (uint64_t)1 << 62 }, sizeof(uint64_t), 1, file);
+	fclose(file);
+	assert(array_reader_open(path, sizeof(int)) == NULL);
+	assert(array_load(path, sizeof(int)) == NULL);
+
+	array_clear(a);
+	assert(array_save(a, path, 0));
+	b = array_load(path, sizeof(int));
+	assert(b && array_empty(b));
+	array_free(b);
+	array_free(a);
+
+	// array_writer, array_reader, blocks don't have to line up
+	ArrayWriter *writer = array_writer_open(path, sizeof(int), ARRAY_SAVE_CHECKSUM);
+	int block[100];
+	for (int j = 0; j < 50; j++) {
+		for (int i = 0; i < 100; i++) {
+			block[i] = j * 100 + i;
+		}
+		assert(array_writer_write(writer, block, 100));
+	}
+	assert(array_writer_close(writer));
+
+	ArrayReader *reader = array_reader_open(path, sizeof(int));
+	assert(array_reader_count(reader) == 5000);
+	size_t read, total = 0;
+	while ((read = array_reader_read(reader, block, 33))) {
+		for (size_t i = 0; i < read; i++) {
+			assert(block[i] == (int)(total + i));
+		}
+		total += read;
+	}
+	assert(total == 5000);
+	assert(array_reader_close(reader));
+
+	// Stopping early isn't a clean read
+	reader = array_reader_open(path, sizeof(int));
+	array_reader_read(reader, block, 100);
+	assert(!array_reader_close(reader));
+	remove(path);
+
+	// Inline storage, small arrays grow inside their header's allocation
+	a = array_new(double);
+	void *inline_data = array_data(a);
+	for (int i = 0; i < 15; i++) {
+		array_push_back(a, &(double){ i });
+	}
+	assert(array_data(a) == inline_data);
+
+	array_set_deque(a, true);
+	for (int i = 0; i < 100; i++) {
+		array_push_front(a, &(double){ -i - 1 });
+	}
+	assert(array_data(a) != inline_data);
+	for (int i = 0; i < 110; i++) {
+		_array_pop_front(a, false);
+	}
+	// Shrinking moves what's left back in
+	assert(array_data(a) == inline_data);
+	for (int i = 0; i < 5; i++) {
+		assert(array_at(a, double, i) == i + 10);
+	}
+
+	array_push_back_n(a, (double[40]){ 0 }, 40);
+	array_shrink_to_fit(a);
+	array_resize(a, 3);
+	array_shrink_to_fit(a);
+	assert(array_data(a) == inline_data);
+	assert(array_at(a, double, 2) == 12.0);
+	array_clear(a);
+	assert(array_data(a) == inline_data);
+	array_free(a);
+
+	// array_concurrent
+	ArrayConcurrent *concurrent = array_concurrent_new(int);
+	pthread_t threads[8];
+	Pusher pushers[8];
+	for (int i = 0; i < 8; i++) {
+		pushers[i] = (Pusher){ concurrent, i };
+		pthread_create(&threads[i], NULL, concurrent_pusher, &pushers[i]);
+	}
+	// Everything below size is copied in, even while pushes are running
+	for (size_t size = 0; size < 160000;) {
+		size = array_concurrent_size(concurrent);
+		if (size) {
+			assert(size % 2 == 0);
+			assert(array_concurrent_at(concurrent, int, size - 2) + 1 ==
+					array_concurrent_at(concurrent, int, size - 1));
+		}
+	}
+	for (int i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	assert(array_concurrent_size(concurrent) == 160000);
+	assert(_array_concurrent_at(concurrent, 160000) == NULL);
+
+	// Every push landed once, pairs stayed together
+	a = array_concurrent_collect(concurrent);
+	assert(array_size(a) == 160000);
+	for (size_t i = 0; i < 160000; i += 2) {
+		assert(array_at(a, int, i) + 1 == array_at(a, int, i + 1));
+		assert(array_at(a, int, i) == array_concurrent_at(concurrent, int, i));
+	}
+	array_sort(a, int);
+	for (int i = 0; i < 8; i++) {
+		assert(array_at(a, int, i * 20000) == i * 1000000);
+		assert(array_at(a, int, i * 20000 + 19999) == i * 1000000 + 19999);
+	}
+	array_free(a);
+	array_concurrent_free(concurrent);
+
+	// array_new_aligned, stays aligned through growing, shrinking and clearing
+	a = array_new_aligned(double, 64);
+	assert((uintptr_t)array_data(a) % 64 == 0);
+	for (int i = 0; i < 1000; i++) {
+		array_push_back(a, &(double){ i });
+		assert((uintptr_t)array_data(a) % 64 == 0);
+	}
+	array_remove_range(a, 10, 1000);
+	assert((uintptr_t)array_data(a) % 64 == 0);
+	assert(array_at(a, double, 9) == 9.0);
+	array_shrink_to_fit(a);
+	assert((uintptr_t)array_data(a) % 64 == 0);
+	array_clear(a);
+	assert((uintptr_t)array_data(a) % 64 == 0);
+	array_free(a);
+	assert(array_new_aligned(int, 48) == NULL);
+
+	// array_set_huge_pages
+	a = array_new(int);
+	array_set_huge_pages(a, true);
+	assert(!array_is_huge(a));
+	size_t huge_count = 2 * ARRAY_HUGE_THRESHOLD / sizeof(int);
+	for (size_t i = 0; i < huge_count; i++) {
+		array_push_back(a, &(int){ i });
+	}
+	assert(array_is_huge(a));
+	// Starts on a huge page so the kernel can back it with them
+	assert((uintptr_t)array_data(a) % (2 * 1024 * 1024) == 0);
+	for (size_t i = 0; i < huge_count; i += 4099) {
+		assert(array_at(a, int, i) == (int)i);
+	}
+	// Slots past size still read as zero after mremap grows it
+	array_resize(a, huge_count + 1000);
+	assert(array_at(a, int, huge_count + 999) == 0);
+	assert(array_at(a, int, huge_count - 1) == (int)huge_count - 1);
+	array_resize(a, 8 * huge_count);
+	assert((uintptr_t)array_data(a) % (2 * 1024 * 1024) == 0);
+	assert(array_at(a, int, huge_count - 1) == (int)huge_count - 1);
+
+	// Shrinking under the threshold goes back to the heap
+	array_resize(a, 100);
+	assert(!array_is_huge(a));
+	assert(array_at(a, int, 99) == 99);
+
+	// Turning it on or off moves data right away
+	array_resize(a, huge_count);
+	assert(array_is_huge(a));
+	array_set_huge_pages(a, false);
+	assert(!array_is_huge(a));
+	assert(array_at(a, int, 99) == 99);
+	array_set_huge_pages(a, true);
+	assert(array_is_huge(a));
+	array_clear(a);
+	assert(!array_is_huge(a));
+	array_free(a);
+
+	// Aligned and huge together, and freeing while huge
+	a = array_new_aligned(double, 64);
+	array_set_huge_pages(a, true);
+	array_resize(a, ARRAY_HUGE_THRESHOLD / sizeof(double));
+	assert(array_is_huge(a));
+	assert((uintptr_t)array_data(a) % 64 == 0);
+	array_free(a);
+
+	// array_stats, only counts when built with ARRAY_STATS
+	a = array_new(int);
+	array_stats_set_name(a, "stats test");
+	for (int i = 0; i < 100; i++) {
+		array_push_back(a, &(int){ i });
+	}
+	array_insert_at(a, 0, &(int){ -1 });
+	array_pop_back(a, int);
+	array_find(a, &(int){ 50 });
+	ArrayStats stats = array_stats(a);
+#ifdef ARRAY_STATS
+	assert(strcmp(stats.name, "stats test") == 0);
+	assert(stats.element_size == sizeof(int));
+	assert(stats.calls[ARRAY_OP_PUSH_BACK] == 100);
+	assert(stats.calls[ARRAY_OP_INSERT] == 1);
+	assert(stats.calls[ARRAY_OP_POP] == 1);
+	assert(stats.calls[ARRAY_OP_FIND] == 1);
+	assert(stats.size == 100 && stats.peak_size == 101);
+	assert(stats.capacity == array_capacity(a) && stats.peak_capacity >= 128);
+	// 8 -> 16 -> ... -> 128, the first few in the header's inline buffer
+	assert(stats.reallocs == 4);
+	// Every push, the 100 moved by the insert and what the reallocs kept
+	assert(stats.bytes_moved >= (101 + 100 + 8 + 16 + 32 + 64) * sizeof(int));
+
+	array_stats_reset(a);
+	stats = array_stats(a);
+	assert(stats.calls[ARRAY_OP_PUSH_BACK] == 0 && stats.reallocs == 0);
+	assert(stats.peak_size == 100 && strcmp(stats.name, "stats test") == 0);
+
+	b = array_new(double);
+	FILE *dump = tmpfile();
+	array_stats_dump(dump);
+	rewind(dump);
+	char dumped[4096] = { 0 };
+	fread(dumped, 1, sizeof(dumped) - 1, dump);
+	fclose(dump);
+	assert(strstr(dumped, "\"name\": \"stats test\""));
+	assert(strstr(dumped, "\"element_size\": 8"));
+
+	// Names are escaped so the dump stays valid JSON
+	array_stats_set_name(b, "say \"hi\"\\\n");
+	dump = tmpfile();
+	array_stats_dump(dump);
+	rewind(dump);
+	memset(dumped, 0, sizeof(dumped));
+	fread(dumped, 1, sizeof(dumped) - 1, dump);
+	fclose(dump);
+	assert(strstr(dumped, "\"name\": \"say \\\"hi\\\"\\\\\\u000a\""));
+	array_free(b);
+#else
+	assert(stats.calls[ARRAY_OP_PUSH_BACK] == 0 && stats.name == NULL);
+#endif
+	array_free(a);
+
+	// array_new_with_allocator, arena
+	ArrayArena *arena = array_arena_new(1024);
+	ArrayAllocator arena_allocator = array_arena_allocator(arena);
+
+	for (int round = 0; round < 3; round++) {
+		for (int j = 0; j < 100; j++) {
+			a = array_new_with_allocator(int, &arena_allocator);
+			for (int i = 0; i < 300; i++) {
+				array_push_back(a, &(int){ i * j });
+			}
+			assert(array_at(a, int, 299) == 299 * j);
+			b = array_map(a, int_squared);
+			assert(array_at(b, int, 10) == 100 * j * j);
+			array_remove_range(a, 0, 290);
+			assert(array_at(a, int, 0) == 290 * j);
+		}
+		// Every array above is gone at once
+		array_arena_reset(arena);
+	}
+
+	// Frees only give back the latest allocation, the rest wait for reset
+	a = array_new_with_allocator(int, &arena_allocator);
+	array_free(a);
+	array_arena_free(arena);
+
+	// array_block_pool
+	ArrayBlockPool *pool = array_block_pool_new();
+	ArrayAllocator pool_allocator = array_block_pool_allocator(pool);
+
+	a = array_new_with_allocator(int, &pool_allocator);
+	for (int i = 0; i < 100000; i++) {
+		array_push_back(a, &(int){ i });
+	}
+	b = array_duplicate(a);
+	assert(array_size(b) == 100000 && array_at(b, int, 99999) == 99999);
+	array_free(b);
+	array_clear(a);
+	assert(array_empty(a));
+
+	for (int j = 0; j < 100; j++) {
+		b = array_new_with_allocator(double, &pool_allocator);
+		array_set_deque(b, true);
+		for (int i = 0; i < 50; i++) {
+			array_push_front(b, &(double){ i });
+		}
+		assert(array_at(b, double, 0) == 49.0);
+		array_free(b);
+	}
+	array_free(a);
+
+	// Big blocks left allocated are freed by reset
+	a = array_new_with_allocator(int, &pool_allocator);
+	array_resize(a, 100000);
+	array_block_pool_reset(pool);
+	array_block_pool_free(pool);
+
+	// ARRAY_DEFINE
+	IntArray ints = IntArray_new();
+
+	for (int i = 0; i < 100; i++) {
+		IntArray_push(ints, i);
+	}
+	assert(IntArray_size(ints) == 100);
+	assert(*IntArray_at(ints, 42) == 42);
+	assert(*IntArray_at(ints, -1) == 99);
+	assert(IntArray_at(ints, 100) == NULL);
+	assert(IntArray_find(ints, 64) == 64);
+	assert(IntArray_find(ints, -1) == -1);
+
+	// Same Array underneath
+	assert(array_at(ints.array, int, 7) == 7);
+	array_push_back(ints.array, &(int){ 100 });
+	assert(IntArray_pop(ints) == 100);
+	assert(IntArray_pop(ints) == 99);
+
+	IntArray negated = IntArray_map(ints, int_negate);
+	assert(IntArray_size(negated) == 99);
+	for (size_t i = 0; i < 99; i++) {
+		assert(IntArray_data(negated)[i] == -(int)i);
+	}
+
+	IntArray_free(ints);
+	IntArray_free(negated);
+
+	// Works in deque mode, and on any Array with the right element_size
+	a = array_new(Vec2);
+	array_set_deque(a, true);
+	Vec2Array vecs = Vec2Array_wrap(a);
+	assert(vecs.array == a);
+	b = array_new(char);
+	assert(IntArray_wrap(b).array == NULL);
+	array_free(b);
+
+	for (int i = 0; i < 20; i++) {
+		Vec2Array_push(vecs, (Vec2){ i, -i });
+		array_push_front(a, &(Vec2){ -i, i });
+	}
+	assert(Vec2Array_at(vecs, 0)->x == -19);
+	assert(Vec2Array_at(vecs, -1)->y == -19);
+	assert(Vec2Array_find(vecs, (Vec2){ 5, -5 }) == 25);
+	assert(Vec2Array_pop(vecs).x == 19);
+
+	Vec2Array_free(vecs);
+
+	// array_slice, array_view_*
+	a = array_new(int);
+	for (int i = 0; i < 100; i++) {
+		array_push_back(a, &(int){ i % 10 });
+	}
+
+	ArrayView view = array_slice(a, 10, -10);
+	assert(array_view_size(view) == 80);
+	assert(view.data == _array_at(a, 10));
+	assert(array_view_at(view, int, 0) == 0 && array_view_at(view, int, -1) == 9);
+	assert(_array_view_at(view, 80) == NULL);
+	assert(array_view_size(array_slice(a, -5, 1000)) == 5);
+	assert(array_view_size(array_slice(a, 50, 20)) == 0);
+	assert(array_view_size(array_slice(a, -1000, 3)) == 3);
+
+	assert(array_view_find(view, &(int){ 3 }) == 3);
+	assert(array_view_find_custom(array_view_slice(view, 4, 20), int_compare, &(int){ 3 }) == 9);
+	assert(array_view_find(view, &(int){ 10 }) == -1);
+	assert(array_view_contains(view, &(int){ 9 }));
+	assert(!array_view_contains_custom(array_view_slice(view, 0, 5), int_compare, &(int){ 7 }));
+	assert(array_view_count(view, &(int){ 0 }) == 8);
+	assert(array_view_count_custom(view, int_compare, &(int){ 5 }) == 8);
+
+	reduced = 0;
+	array_view_reduce(view, int_summation, &reduced);
+	assert(reduced == 8 * 45);
+
+	b = array_view_filter(view, int_under_ten);
+	assert(array_size(b) == 80);
+	array_free(b);
+	b = array_view_map(array_slice(a, 0, 3), int_squared);
+	assert(array_size(b) == 3 && array_at(b, int, 2) == 4);
+	array_free(b);
+
+	// Stepped views skip elements, every tenth one here is a 5
+	ArrayView fives = array_view_step(array_slice(a, 5, 100), 10);
+	assert(array_view_size(fives) == 10);
+	assert(array_view_count(fives, &(int){ 5 }) == 10);
+	assert(array_view_find(fives, &(int){ 6 }) == -1);
+	reduced = 0;
+	array_view_reduce(fives, int_summation, &reduced);
+	assert(reduced == 50);
+	assert(array_view_size(array_view_step(view, 3)) == 27);
+
+	// Deques get made contiguous
+	array_set_deque(a, true);
+	array_push_front(a, &(int){ -1 });
+	view = array_view(a);
+	assert(array_view_size(view) == 101 && array_view_at(view, int, 0) == -1);
+	array_view_print(array_slice(a, 0, 4), itos);
+
+	array_free(a);
+
+	// array_segmented
+	ArraySegmented *segmented = array_segmented_new(int);
+	assert(array_segmented_size(segmented) == 0);
+	assert(_array_segmented_at(segmented, 0) == NULL);
+	assert(_array_segmented_pop_back(segmented) == NULL);
+
+	int *first = array_segmented_push_back(segmented, &(int){ 0 });
+	assert(*first == 0);
+	for (int i = 1; i < 5000; i++) {
+		array_segmented_push_back(segmented, &i);
+	}
+	// Growing never moved the first element
+	assert(first == _array_segmented_at(segmented, 0));
+	assert(array_segmented_size(segmented) == 5000);
+	assert(array_segmented_capacity(segmented) >= 5000);
+	for (int i = 0; i < 5000; i++) {
+		assert(array_segmented_at(segmented, int, i) == i);
+	}
+	assert(array_segmented_at(segmented, int, -1) == 4999);
+	assert(_array_segmented_at(segmented, 5000) == NULL);
+	assert(_array_segmented_at(segmented, -5001) == NULL);
+
+	int segmented_batch[3000];
+	for (int i = 0; i < 3000; i++) {
+		segmented_batch[i] = 5000 + i;
+	}
+	assert(array_segmented_push_back_n(segmented, segmented_batch, 3000));
+	assert(first == _array_segmented_at(segmented, 0));
+	for (int i = 0; i < 8000; i++) {
+		assert(array_segmented_at(segmented, int, i) == i);
+	}
+
+	// Chunks cover the array in order
+	size_t chunked = 0;
+	while (chunked < array_segmented_size(segmented)) {
+		size_t count;
+		int *chunk = array_segmented_chunk(segmented, chunked, &count);
+		assert(count > 0 && chunk[0] == (int)chunked);
+		chunked += count;
+	}
+
+	array_segmented_set(segmented, 10, &(int){ -10 });
+	assert(array_segmented_at(segmented, int, 10) == -10);
+	assert(array_segmented_pop_back(segmented, int) == 7999);
+	assert(array_segmented_size(segmented) == 7999);
+
+	a = array_segmented_collect(segmented);
+	assert(array_size(a) == 7999);
+	assert(array_at(a, int, 10) == -10);
+	assert(array_at(a, int, 7998) == 7998);
+	array_free(a);
+
+	size_t capacity = array_segmented_capacity(segmented);
+	array_segmented_clear(segmented);
+	assert(array_segmented_size(segmented) == 0);
+	assert(array_segmented_capacity(segmented) == capacity);
+	assert(array_segmented_push_back(segmented, &(int){ 42 }) == first);
+
+	array_segmented_free(segmented);
+
+	// Segments too big to allocate fail instead of wrapping the size
+	segmented = _array_segmented_new(SIZE_MAX / 512);
+	assert(!array_segmented_reserve(segmented, 1));
+	assert(array_segmented_capacity(segmented) == 0);
+	array_segmented_free(segmented);
+
+	// array_soa
+	ArrayField fields[] = { ARRAY_FIELD(Particle, id), ARRAY_FIELD(Particle, mass),
+		ARRAY_FIELD(Particle, tag) };
+	assert(array_soa_new(Vec2, fields, 3) == NULL);
+	ArraySoA *soa = array_soa_new(Particle, fields, 3);
+	assert(array_soa_field_count(soa) == 3);
+	assert(array_soa_size(soa) == 0);
+
+	for (int i = 0; i < 100; i++) {
+		array_soa_push_back(soa, &(Particle){ 'a' + i % 26, i * 0.5, i });
+	}
+	assert(array_soa_size(soa) == 100);
+
+	Particle particle;
+	assert(array_soa_get(soa, 7, &particle));
+	assert(particle.id == 7 && particle.mass == 3.5 && particle.tag == 'h');
+	assert(array_soa_get(soa, -1, &particle) && particle.id == 99);
+	assert(!array_soa_get(soa, 100, &particle));
+
+	// Columns are plain contiguous values
+	int *ids = array_soa_column(soa, 0);
+	double *masses = array_soa_column(soa, 1);
+	for (int i = 0; i < 100; i++) {
+		assert(ids[i] == i && masses[i] == i * 0.5);
+	}
+	assert(array_soa_column(soa, 3) == NULL);
+
+	double total_mass = 0.0;
+	array_reduce(array_soa_field(soa, 1), double_summation, &total_mass);
+	assert(total_mass == 2475.0);
+
+	array_soa_set(soa, 0, &(Particle){ 'z', 10.0, -1 });
+	array_soa_insert_at(soa, 1, &(Particle){ 'y', 20.0, -2 });
+	array_soa_remove_at(soa, 2);
+	assert(array_soa_size(soa) == 100);
+	assert(array_soa_get(soa, 0, &particle) && particle.id == -1 && particle.tag == 'z');
+	assert(array_soa_get(soa, 1, &particle) && particle.id == -2 && particle.mass == 20.0);
+	assert(array_soa_get(soa, 2, &particle) && particle.id == 2);
+
+	assert(array_soa_pop_back(soa, &particle) && particle.id == 99);
+	assert(array_soa_pop_back(soa, NULL));
+	assert(array_soa_size(soa) == 98);
+
+	array_soa_clear(soa);
+	assert(array_soa_size(soa) == 0);
+	assert(!array_soa_pop_back(soa, &particle));
+	array_soa_reserve(soa, 1000);
+	assert(array_capacity(array_soa_field(soa, 2)) >= 1000);
+
+	array_soa_free(soa);
+
 	// array_print verify by using your EYES
 	a = array_new(int);
 